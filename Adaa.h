@@ -0,0 +1,302 @@
+#pragma once
+
+#include "Commons.h"
+#include <stdint.h>
+#include <cmath>
+
+/**
+ * Antiderivative anti-aliasing for the waveshapers in Commons.h, see
+ * Parker, Zavalishin, Le Bivic - "Reducing the aliasing of nonlinear
+ * waveshaping using continuous-time convolution" (DAFx-16) and
+ * Bilbao, Esqueda, Parker, Välimäki - "Antiderivative antialiasing for
+ * memoryless nonlinearities" (IEEE SPL 2017).
+ *
+ * Each shape provides the function, its first and second antiderivative
+ * and the input level above which it's flat (0 if it never is).
+ * The first order versions delay the signal by half a sample, the second
+ * order ones by a sample, and both act as a gentle lowpass. That builds up
+ * in feedback loops and dulls the output, so they're only meant for open
+ * loop drive stages, with the dry signal delayed to match.
+ */
+
+// Below these input differences the quotients are replaced by their limit.
+constexpr float kAdaa1Tolerance = 1e-3f;
+constexpr double kAdaa2Tolerance = 1e-5;
+
+struct SoftLimitShape
+{
+    static constexpr float kKnee = 0.f;
+
+    static inline float Value(float x)
+    {
+        return SoftLimit(x);
+    }
+
+    // f(x) = x / 9 + 8/3 * x / (x^2 + 3)
+    static inline float Anti1(float x)
+    {
+        float x2 = x * x;
+
+        return x2 * 0.0555555556f + 1.33333333f * logf(x2 + 3.f);
+    }
+
+    static inline double Anti2(double x)
+    {
+        double x2 = x * x;
+
+        return x * x2 * (1.0 / 54.0) + (4.0 / 3.0) * (x * log(x2 + 3.0) - 2.0 * x + 2.0 * 1.7320508075688772 * atan(x * 0.5773502691896258));
+    }
+};
+
+struct SoftClipShape
+{
+    static constexpr float kKnee = 3.f;
+
+    static inline float Value(float x)
+    {
+        return SoftClip(x);
+    }
+
+    static inline float Anti1(float x)
+    {
+        if (x >= 3.f || x <= -3.f)
+        {
+            // SoftLimitShape::Anti1(3) + |x| - 3
+            return 0.81320887f + fabsf(x);
+        }
+
+        return SoftLimitShape::Anti1(x);
+    }
+
+    static inline double Anti2(double x)
+    {
+        // SoftLimitShape::Anti1(3) and SoftLimitShape::Anti2(3)
+        const double c1 = 3.8132088714;
+        const double c2 = 7.2764249091;
+
+        if (x >= 3.0)
+        {
+            double d = x - 3.0;
+
+            return c2 + c1 * d + d * d * 0.5;
+        }
+        if (x <= -3.0)
+        {
+            double d = x + 3.0;
+
+            return -c2 + c1 * d - d * d * 0.5;
+        }
+
+        return SoftLimitShape::Anti2(x);
+    }
+};
+
+struct HardClipShape
+{
+    static constexpr float kKnee = 1.f;
+
+    static inline float Value(float x)
+    {
+        return HardClip(x);
+    }
+
+    static inline float Anti1(float x)
+    {
+        if (x > 1.f || x < -1.f)
+        {
+            return fabsf(x) - 0.5f;
+        }
+
+        return x * x * 0.5f;
+    }
+
+    static inline double Anti2(double x)
+    {
+        if (x > 1.0)
+        {
+            return (x * x - x) * 0.5 + 1.0 / 6.0;
+        }
+        if (x < -1.0)
+        {
+            return (-x * x - x) * 0.5 - 1.0 / 6.0;
+        }
+
+        return x * x * x * (1.0 / 6.0);
+    }
+};
+
+/**
+ * @brief First order ADAA: the output is the mean of the function over the
+ *        segment between the previous input and the current one. While both
+ *        inputs are on the linear part of the shape the input is passed
+ *        through, so signals that don't clip are left untouched.
+ *
+ * @tparam T Shape
+ * @tparam N Number of independent channels
+ */
+template <class T, size_t N = 2>
+class Adaa1
+{
+private:
+    float x1_[N];
+    float ad1_[N];
+
+public:
+    Adaa1()
+    {
+        Reset();
+    }
+    ~Adaa1() {}
+
+    void Reset()
+    {
+        for (size_t c = 0; c < N; c++)
+        {
+            x1_[c] = 0;
+            ad1_[c] = T::Anti1(0);
+        }
+    }
+
+    inline float Process(size_t channel, float x)
+    {
+        float x1 = x1_[channel];
+        float ad = T::Anti1(x);
+        float d = x - x1;
+
+        float y;
+        if (T::kKnee > 0 && (x >= T::kKnee && x1 >= T::kKnee))
+        {
+            // Both on the flat part, also avoids cancellation with large
+            // inputs.
+            y = T::Value(T::kKnee);
+        }
+        else if (T::kKnee > 0 && (x <= -T::kKnee && x1 <= -T::kKnee))
+        {
+            y = T::Value(-T::kKnee);
+        }
+        else if (d > kAdaa1Tolerance || d < -kAdaa1Tolerance)
+        {
+            y = (ad - ad1_[channel]) / d;
+        }
+        else
+        {
+            y = T::Value((x + x1) * 0.5f);
+        }
+
+        x1_[channel] = x;
+        ad1_[channel] = ad;
+
+        return y;
+    }
+
+    /**
+     * @brief Processes a block for all the channels.
+     */
+    inline void Process(const float* const* input, float* const* output, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            for (size_t c = 0; c < N; c++)
+            {
+                output[c][i] = Process(c, input[c][i]);
+            }
+        }
+    }
+};
+
+/**
+ * @brief Second order ADAA, stronger attenuation of the aliases at the cost
+ *        of a sample of delay. The divided differences lose too much
+ *        precision in single precision, so they're computed in double.
+ *
+ * @tparam T Shape
+ * @tparam N Number of independent channels
+ */
+template <class T, size_t N = 2>
+class Adaa2
+{
+private:
+    double x1_[N], x2_[N];
+    double ad2_[N]; // Second antiderivative at x1
+    double d1_[N]; // First divided difference between x2 and x1
+
+    inline double Difference(double x, double x1, double ad, double ad1)
+    {
+        double d = x - x1;
+        if (d > kAdaa2Tolerance || d < -kAdaa2Tolerance)
+        {
+            return (ad - ad1) / d;
+        }
+
+        return T::Anti1((x + x1) * 0.5);
+    }
+
+public:
+    Adaa2()
+    {
+        Reset();
+    }
+    ~Adaa2() {}
+
+    void Reset()
+    {
+        for (size_t c = 0; c < N; c++)
+        {
+            x1_[c] = x2_[c] = 0;
+            ad2_[c] = T::Anti2(0);
+            d1_[c] = T::Anti1(0);
+        }
+    }
+
+    inline float Process(size_t channel, float in)
+    {
+        double x = in;
+        double x1 = x1_[channel];
+        double x2 = x2_[channel];
+
+        double ad = T::Anti2(x);
+        double d0 = Difference(x, x1, ad, ad2_[channel]);
+
+        double y;
+        double d = x - x2;
+        if (d > kAdaa2Tolerance || d < -kAdaa2Tolerance)
+        {
+            y = 2.0 * (d0 - d1_[channel]) / d;
+        }
+        else
+        {
+            // Going back and forth around x1.
+            double xm = (x + x2) * 0.5;
+            double dm = xm - x1;
+            if (dm > kAdaa2Tolerance || dm < -kAdaa2Tolerance)
+            {
+                y = 2.0 / dm * (T::Anti1(xm) + (ad2_[channel] - T::Anti2(xm)) / dm);
+            }
+            else
+            {
+                y = T::Value((xm + x1) * 0.5);
+            }
+        }
+
+        x2_[channel] = x1;
+        x1_[channel] = x;
+        ad2_[channel] = ad;
+        d1_[channel] = d0;
+
+        return y;
+    }
+
+    /**
+     * @brief Processes a block for all the channels.
+     */
+    inline void Process(const float* const* input, float* const* output, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            for (size_t c = 0; c < N; c++)
+            {
+                output[c][i] = Process(c, input[c][i]);
+            }
+        }
+    }
+};
@@ -2,11 +2,13 @@
 
 #include "Commons.h"
 #include "BiquadFilter.h"
-#include "DelayLine.h"
+#include "Interpolator.h"
 #include "SineOscillator.h"
 #include "EnvFollower.h"
 #include "DcBlockingFilter.h"
 #include "Compressor.h"
+#include "Bypass.h"
+#include "HalfBand.h"
 
 class Damp
 {
@@ -95,34 +97,51 @@ public:
     }
 }; // End Damp
 
+/**
+ * @brief The diffusers of both channels as one network of delay lanes: three
+ *        allpass stages and a loop delay per channel. The lanes are
+ *        interleaved in a single buffer, lane = stage * 2 + channel, so both
+ *        channels of a stage share the read position and go through it
+ *        together. The loop delays cross back to the other channel, and the
+ *        channels can also be rotated into each other after every allpass
+ *        stage for a wider diffusion, which keeps the network lossless.
+ */
 class Diffuse
 {
 public:
-    Diffuse()
+    Diffuse(float sampleRate)
     {
-        for (int i = 0; i < kAmbienceNofDiffusers; i++)
+        sampleRate_ = sampleRate;
+        line_ = FloatArray::create(kAmbienceBufferSize * kAmbienceNofLanes);
+        line_.clear();
+        writeIndex_ = 0;
+
+        for (int i = 0; i < kAmbienceNofLanes; i++)
         {
-            diffuse_[i] = DelayLine::create(kAmbienceBufferSize);
+            outs_[i] = 0;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            fbOuts_[i] = 0;
         }
 
-        fbOut_ = 0;
         df_ = 0;
+        time_ = 0;
         needsUpdate_ = false;
 
+        SetWidth(kAmbienceDiffusionWidth);
         SetSZ(1);
+        UpdateDelayTimes();
         SetRT(0);
     }
     ~Diffuse()
     {
-        for (int i = 0; i < kAmbienceNofDiffusers; i++)
-        {
-            DelayLine::destroy(diffuse_[i]);
-        }
+        FloatArray::destroy(line_);
     }
 
-    static Diffuse* create()
+    static Diffuse* create(float sampleRate)
     {
-        return new Diffuse();
+        return new Diffuse(sampleRate);
     }
 
     static void destroy(Diffuse* diffuse)
@@ -135,10 +154,10 @@ public:
         size_ = size;
         for (size_t i = 0; i < kAmbienceNofDiffusers - 1; i++)
         {
-            newDelayTimes_[i] = M2D(size + 2.f * (i + 1));
+            newDelayTimes_[i] = M2D(size + 2.f * (i + 1), sampleRate_);
         }
 
-        newDelayTimes_[kAmbienceNofDiffusers - 1] = M2D(size - 7.f);
+        newDelayTimes_[kAmbienceNofDiffusers - 1] = M2D(size - 7.f, sampleRate_);
         SetRT(time_);
         needsUpdate_ = true;
     }
@@ -146,7 +165,7 @@ public:
     void SetRT(float time)
     {
         time_ = time;
-        rt_ = Db2A((delayTimes_[kAmbienceNofDiffusers - 1] / M2D(time)) * -60.f);
+        rt_ = Db2A((delayTimes_[kAmbienceNofDiffusers - 1] / M2D(time, sampleRate_)) * -60.f);
         if (rt_ >= kOne) {
             rt_ = 1.f;
         }
@@ -157,9 +176,24 @@ public:
         df_ = _df;
     }
 
-    float GetFbOut()
+    /**
+     * @brief Amount of rotation between the channels after each allpass
+     *        stage, 0 keeps them apart and 1 mixes them evenly.
+     */
+    void SetWidth(float width)
+    {
+        float a = Clamp(width, 0.f, 1.f) * M_PI * 0.25f;
+        cos_ = cosf(a);
+        sin_ = sinf(a);
+    }
+
+    /**
+     * @brief The feedback into a channel, coming from the loop delay of the
+     *        other one.
+     */
+    float GetFbOut(int channel)
     {
-        return fbOut_;
+        return fbOuts_[channel];
     }
 
     void UpdateDelayTimes()
@@ -176,31 +210,104 @@ public:
         needsUpdate_ = false;
     }
 
-    float Process(const float in, const float x)
+    void Process(float& left, float& right, const float x)
     {
-        float out = in;
+        float out[2] = { left, right };
 
         for (int i = 0; i < kAmbienceNofDiffusers - 1; i++)
         {
-            float prev = HardClip(out - outs_[i] * df_);
-            diffuse_[i]->write(prev);
-            out = HardClip(prev * df_ + outs_[i]);
-            outs_[i] = diffuse_[i]->read(delayTimes_[i], newDelayTimes_[i], x);
+            float* outs = &outs_[i * 2];
+            for (int j = 0; j < 2; j++)
+            {
+                float prev = HardClip(out[j] - outs[j] * df_);
+                Write(i * 2 + j, prev);
+                out[j] = HardClip(prev * df_ + outs[j]);
+            }
+            Read(i, x);
+
+            if (sin_ != 0)
+            {
+                float l = out[0] * cos_ - out[1] * sin_;
+                out[1] = out[0] * sin_ + out[1] * cos_;
+                out[0] = l;
+            }
         }
 
-        int lastDiff = kAmbienceNofDiffusers - 1;
-        fbOut_ = outs_[lastDiff] * rt_;
-        diffuse_[lastDiff]->write(out);
-        outs_[lastDiff] = diffuse_[lastDiff]->read(delayTimes_[lastDiff], newDelayTimes_[lastDiff], x);
+        const int lastDiff = kAmbienceNofDiffusers - 1;
+        float* outs = &outs_[lastDiff * 2];
+        fbOuts_[LEFT_CHANNEL] = outs[RIGHT_CHANNEL] * rt_;
+        fbOuts_[RIGHT_CHANNEL] = outs[LEFT_CHANNEL] * rt_;
+        for (int j = 0; j < 2; j++)
+        {
+            Write(lastDiff * 2 + j, out[j]);
+        }
+        Read(lastDiff, x);
 
-        return out;
+        writeIndex_ += kAmbienceNofLanes;
+        if (writeIndex_ >= kAmbienceBufferSize * kAmbienceNofLanes)
+        {
+            writeIndex_ = 0;
+        }
+
+        left = out[0];
+        right = out[1];
     }
 
 private:
-    DelayLine *diffuse_[kAmbienceNofDiffusers];
+    FloatArray line_;
+    int32_t writeIndex_;
     float delayTimes_[kAmbienceNofDiffusers], newDelayTimes_[kAmbienceNofDiffusers];
-    float size_, time_, rt_, df_, fbOut_, outs_[kAmbienceNofDiffusers];
+    float sampleRate_, size_, time_, rt_, df_, cos_, sin_;
+    float outs_[kAmbienceNofLanes], fbOuts_[2];
     bool needsUpdate_;
+
+    inline void Write(int lane, float value)
+    {
+        line_[writeIndex_ + lane] = Clamp(value, -3.f, 3.f);
+    }
+
+    /**
+     * @brief Reads both lanes of a stage, the sample just written is at
+     *        delay 0.
+     */
+    inline void ReadAt(int stage, float delay, float* out)
+    {
+        int32_t d = (int32_t)delay;
+        float frac = delay - d;
+        int32_t i0 = writeIndex_ - d * kAmbienceNofLanes;
+        if (i0 < 0)
+        {
+            i0 += kAmbienceBufferSize * kAmbienceNofLanes;
+        }
+        int32_t i1 = i0 - kAmbienceNofLanes;
+        if (i1 < 0)
+        {
+            i1 += kAmbienceBufferSize * kAmbienceNofLanes;
+        }
+        const float* y0 = &line_[i0 + stage * 2];
+        const float* y1 = &line_[i1 + stage * 2];
+        for (int j = 0; j < 2; j++)
+        {
+            out[j] = Interpolator::linear(y0[j], y1[j], frac);
+        }
+    }
+
+    inline void Read(int stage, float x)
+    {
+        float* outs = &outs_[stage * 2];
+        ReadAt(stage, delayTimes_[stage], outs);
+        if (x == 0)
+        {
+            return;
+        }
+
+        float next[2];
+        ReadAt(stage, newDelayTimes_[stage], next);
+        for (int j = 0; j < 2; j++)
+        {
+            outs[j] = outs[j] * (1.f - x) + next[j] * x;
+        }
+    }
 }; // End Diffuse
 
 class ReversedBuffer
@@ -291,6 +398,8 @@ private:
 /**
  * @brief This is taken from my Reaktor ensemble Aerosynth.
  *        https://www.native-instruments.com/de/reaktor-community/reaktor-user-library/entry/show/3431/
+ *        With USE_AMBIENCE_HALF_RATE the reverb runs at half the sample
+ *        rate, its tail is damped well below the lower Nyquist anyway.
  */
 class Ambience
 {
@@ -302,12 +411,19 @@ private:
     SineOscillator *panner_;
 
     Damp *dampFilters_[2];
-    Diffuse *diffusers_[2];
+    Diffuse *diffuse_;
     ReversedBuffer *reversers_[2];
 
     EnvFollower* ef_[2];
-    Compressor* comp_[2];
+    StereoCompressor* comp_;
+    AudioBuffer* wet_;
+#ifdef USE_AMBIENCE_HALF_RATE
+    StereoHalfBand<4>* decimator_;
+    StereoHalfBand<4>* interpolator_;
+    AudioBuffer* low_;
+#endif
     DcBlockingFilter* dc_[2];
+    Bypass* bypass_;
 
     float amp_, pan_, decay_, spaceTime_;
     float reverse_;
@@ -335,19 +451,16 @@ private:
 
     void SetDecayTime(float time)
     {
-        diffusers_[LEFT_CHANNEL]->SetRT(time);
-        diffusers_[RIGHT_CHANNEL]->SetRT(time);
+        diffuse_->SetRT(time);
     }
 
     void SetSize(float size)
     {
         float sz = -(size - 30.f);
-        diffusers_[LEFT_CHANNEL]->SetSZ(sz);
-        diffusers_[RIGHT_CHANNEL]->SetSZ(sz);
+        diffuse_->SetSZ(sz);
 
         float df = (size * 0.004166667f) + 0.5f; // 1 / 240
-        diffusers_[LEFT_CHANNEL]->SetDf(df);
-        diffusers_[RIGHT_CHANNEL]->SetDf(df);
+        diffuse_->SetDf(df);
     }
 
     void SetPan(float value)
@@ -423,14 +536,20 @@ public:
 
         for (size_t i = 0; i < 2; i++)
         {
-            dampFilters_[i] = Damp::create(patchState_->sampleRate);
-            diffusers_[i] = Diffuse::create();
+            dampFilters_[i] = Damp::create(patchState_->sampleRate / kAmbienceRateDivider);
             reversers_[i] = ReversedBuffer::create(kAmbienceBufferSize);
             ef_[i] = EnvFollower::create();
             dc_[i] = DcBlockingFilter::create();
-            comp_[i] = Compressor::create(patchState_->sampleRate);
-            comp_[i]->setThreshold(-20);
         }
+        diffuse_ = Diffuse::create(patchState_->sampleRate / kAmbienceRateDivider);
+        comp_ = StereoCompressor::create(patchState_->sampleRate);
+        comp_->setThreshold(-20);
+        wet_ = AudioBuffer::create(2, patchState_->blockSize);
+#ifdef USE_AMBIENCE_HALF_RATE
+        decimator_ = StereoHalfBand<4>::create(kHalfBandSteepA, kHalfBandSteepB);
+        interpolator_ = StereoHalfBand<4>::create(kHalfBandSteepA, kHalfBandSteepB);
+        low_ = AudioBuffer::create(2, patchState_->blockSize / kAmbienceRateDivider);
+#endif
 
         dampFilters_[LEFT_CHANNEL]->SetHp(112);
         dampFilters_[LEFT_CHANNEL]->SetLp(60);
@@ -439,23 +558,31 @@ public:
         dampFilters_[RIGHT_CHANNEL]->SetLp(51);
 
         panner_ = SineOscillator::create(patchState_->blockRate);
+        bypass_ = Bypass::create(patchState_->blockSize / kAmbienceRateDivider, kAmbienceBufferSize);
 
         amp_ = 1.f;
         pan_ = 0.5f;
-        xi_ = 1.f / patchState_->blockSize;
+        xi_ = 1.f * kAmbienceRateDivider / patchState_->blockSize;
     }
     ~Ambience()
     {
         for (size_t i = 0; i < 2; i++)
         {
             Damp::destroy(dampFilters_[i]);
-            Diffuse::destroy(diffusers_[i]);
             ReversedBuffer::destroy(reversers_[i]);
             EnvFollower::destroy(ef_[i]);
             DcBlockingFilter::destroy(dc_[i]);
-            Compressor::destroy(comp_[i]);
         }
+        Diffuse::destroy(diffuse_);
+        StereoCompressor::destroy(comp_);
+        AudioBuffer::destroy(wet_);
+#ifdef USE_AMBIENCE_HALF_RATE
+        StereoHalfBand<4>::destroy(decimator_);
+        StereoHalfBand<4>::destroy(interpolator_);
+        AudioBuffer::destroy(low_);
+#endif
         SineOscillator::destroy(panner_);
+        Bypass::destroy(bypass_);
     }
 
     static Ambience* create(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
@@ -476,6 +603,16 @@ public:
         FloatArray leftOut = output.getSamples(LEFT_CHANNEL);
         FloatArray rightOut = output.getSamples(RIGHT_CHANNEL);
 
+        if (!bypass_->Process(patchCtrls_->ambienceVol))
+        {
+            if (&input != &output)
+            {
+                output.copyFrom(input);
+            }
+
+            return;
+        }
+
         SetPan(patchCtrls_->ambienceAutoPan);
 
         float d = Modulate(patchCtrls_->ambienceDecay, patchCtrls_->ambienceDecayModAmount, patchState_->modValue, patchCtrls_->ambienceDecayCvAmount, patchCvs_->ambienceDecay, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
@@ -492,19 +629,42 @@ public:
         float r = 1.f - reverse_;
         float x = 0;
 
-        for (size_t i = 0; i < size; i++)
+        size_t reverbSize = size / kAmbienceRateDivider;
+
+#ifdef USE_AMBIENCE_HALF_RATE
+        // The reverb reads its input from the low rate buffer and writes its
+        // output back in place.
+        FloatArray leftFeed = low_->getSamples(LEFT_CHANNEL);
+        FloatArray rightFeed = low_->getSamples(RIGHT_CHANNEL);
+        FloatArray leftWet = leftFeed;
+        FloatArray rightWet = rightFeed;
+
+        float* in[2] = {leftIn.getData(), rightIn.getData()};
+        float* low[2] = {leftFeed.getData(), rightFeed.getData()};
+        decimator_->Decimate(in, low, reverbSize);
+#else
+        FloatArray leftFeed = leftIn;
+        FloatArray rightFeed = rightIn;
+        FloatArray leftWet = wet_->getSamples(LEFT_CHANNEL);
+        FloatArray rightWet = wet_->getSamples(RIGHT_CHANNEL);
+#endif
+
+        for (size_t i = 0; i < reverbSize; i++)
         {
-            float lIn = Clamp(leftIn[i], -3.f, 3.f);
-            float rIn = Clamp(rightIn[i], -3.f, 3.f);
+            float lIn = Clamp(leftFeed[i], -3.f, 3.f);
+            float rIn = Clamp(rightFeed[i], -3.f, 3.f);
+            float g = bypass_->InputGain();
+            float lFeed = lIn * g;
+            float rFeed = rIn * g;
 
-            float left = reversers_[LEFT_CHANNEL]->LastOut() * reverse_ + lIn * r;
-            float right = reversers_[RIGHT_CHANNEL]->LastOut() * reverse_ + rIn * r;
+            float left = reversers_[LEFT_CHANNEL]->LastOut() * reverse_ + lFeed * r;
+            float right = reversers_[RIGHT_CHANNEL]->LastOut() * reverse_ + rFeed * r;
 
-            reversers_[LEFT_CHANNEL]->Process(lIn);
-            reversers_[RIGHT_CHANNEL]->Process(rIn);
+            reversers_[LEFT_CHANNEL]->Process(lFeed);
+            reversers_[RIGHT_CHANNEL]->Process(rFeed);
 
-            float leftFb = dampFilters_[LEFT_CHANNEL]->Process(left + diffusers_[RIGHT_CHANNEL]->GetFbOut());
-            float rightFb = dampFilters_[RIGHT_CHANNEL]->Process(right + diffusers_[LEFT_CHANNEL]->GetFbOut());
+            float leftFb = dampFilters_[LEFT_CHANNEL]->Process(left + diffuse_->GetFbOut(LEFT_CHANNEL));
+            float rightFb = dampFilters_[RIGHT_CHANNEL]->Process(right + diffuse_->GetFbOut(RIGHT_CHANNEL));
 
             leftFb = HardClip(left * (1.f - pan_) + leftFb);
             rightFb = HardClip(right * pan_ + rightFb);
@@ -515,21 +675,37 @@ public:
             leftFb = dc_[LEFT_CHANNEL]->process(leftFb);
             rightFb = dc_[RIGHT_CHANNEL]->process(rightFb);
 
-            left = diffusers_[LEFT_CHANNEL]->Process(leftFb, x);
-            right = diffusers_[RIGHT_CHANNEL]->Process(rightFb, x);
+            bypass_->Track(leftFb, rightFb);
+
+            left = leftFb;
+            right = rightFb;
+            diffuse_->Process(left, right, x);
 
             x += xi_;
 
             float a = Map(decay_, 0.f, 1.f, amp_ * 1.3f, amp_);
 
-            left = comp_[LEFT_CHANNEL]->process(left * a) * kAmbienceMakeupGain;
-            right = comp_[RIGHT_CHANNEL]->process(right * a) * kAmbienceMakeupGain;
+            leftWet[i] = left * a;
+            rightWet[i] = right * a;
+        }
+
+#ifdef USE_AMBIENCE_HALF_RATE
+        float* wet[2] = {wet_->getSamples(LEFT_CHANNEL).getData(), wet_->getSamples(RIGHT_CHANNEL).getData()};
+        interpolator_->Interpolate(low, wet, reverbSize);
+        leftWet = wet_->getSamples(LEFT_CHANNEL);
+        rightWet = wet_->getSamples(RIGHT_CHANNEL);
+#endif
+
+        comp_->process(*wet_, *wet_);
 
-            leftOut[i] = CheapEqualPowerCrossFade(lIn, left, patchCtrls_->ambienceVol, 1.4f);
-            rightOut[i] = CheapEqualPowerCrossFade(rIn, right, patchCtrls_->ambienceVol, 1.4f);
+        for (size_t i = 0; i < size; i++)
+        {
+            float lIn = Clamp(leftIn[i], -3.f, 3.f);
+            float rIn = Clamp(rightIn[i], -3.f, 3.f);
+            leftOut[i] = CheapEqualPowerCrossFade(lIn, leftWet[i] * kAmbienceMakeupGain, patchCtrls_->ambienceVol, 1.4f);
+            rightOut[i] = CheapEqualPowerCrossFade(rIn, rightWet[i] * kAmbienceMakeupGain, patchCtrls_->ambienceVol, 1.4f);
         }
 
-        diffusers_[LEFT_CHANNEL]->UpdateDelayTimes();
-        diffusers_[RIGHT_CHANNEL]->UpdateDelayTimes();
+        diffuse_->UpdateDelayTimes();
     }
 };
\ No newline at end of file
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "Commons.h"
+
+enum BypassState
+{
+    BYPASS_ACTIVE, // Wet signal audible
+    BYPASS_DRAINING, // Wet signal muted, input faded out, waiting for the tail to die
+    BYPASS_OFF, // Nothing left to hear, the effect can be skipped
+};
+
+/**
+ * @brief Tells an effect when it can skip its processing. When the wet level
+ *        goes to zero the effect stops being fed and keeps running until its
+ *        tail has been quiet for as long as its longest buffer, then it's
+ *        switched off. When the wet level is raised again it starts from
+ *        that silent state, with the input faded in.
+ */
+class Bypass
+{
+private:
+    BypassState state_;
+
+    float level_;
+    float gain_, target_, inc_;
+    int holdBlocks_, quietBlocks_;
+
+public:
+    /**
+     * @param blockSize
+     * @param holdSamples Length of the longest buffer of the effect, the tail
+     *        must be quiet for this long before switching off
+     */
+    Bypass(size_t blockSize, size_t holdSamples)
+    {
+        state_ = BYPASS_ACTIVE;
+        level_ = 0;
+        gain_ = target_ = 1.f;
+        inc_ = 1.f / blockSize;
+        holdBlocks_ = holdSamples / blockSize + 1;
+        quietBlocks_ = 0;
+    }
+    ~Bypass() {}
+
+    static Bypass* create(size_t blockSize, size_t holdSamples)
+    {
+        return new Bypass(blockSize, holdSamples);
+    }
+
+    static void destroy(Bypass* obj)
+    {
+        delete obj;
+    }
+
+    BypassState GetState()
+    {
+        return state_;
+    }
+
+    /**
+     * @brief Call at the start of the block.
+     *
+     * @param vol Wet level
+     * @return false if the effect can be skipped for this block
+     */
+    bool Process(float vol)
+    {
+        float level = level_;
+        level_ = 0;
+
+        if (vol > kBypassVolThreshold)
+        {
+            state_ = BYPASS_ACTIVE;
+            target_ = 1.f;
+            quietBlocks_ = 0;
+
+            return true;
+        }
+
+        if (BYPASS_OFF == state_)
+        {
+            return false;
+        }
+
+        state_ = BYPASS_DRAINING;
+        target_ = 0.f;
+
+        if (0.f == gain_ && level < kBypassTailThreshold)
+        {
+            if (++quietBlocks_ >= holdBlocks_)
+            {
+                state_ = BYPASS_OFF;
+
+                return false;
+            }
+        }
+        else
+        {
+            quietBlocks_ = 0;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Gain to apply to the signal fed to the effect, call once per
+     *        sample.
+     */
+    inline float InputGain()
+    {
+        if (gain_ < target_)
+        {
+            gain_ = Min(gain_ + inc_, target_);
+        }
+        else if (gain_ > target_)
+        {
+            gain_ = Max(gain_ - inc_, target_);
+        }
+
+        return gain_;
+    }
+
+    /**
+     * @brief Feeds the level of the tail, i.e. what's being written in the
+     *        effect's buffers.
+     */
+    inline void Track(float left, float right)
+    {
+        level_ = Max(level_, Max(fabsf(left), fabsf(right)));
+    }
+};
@@ -5,6 +5,7 @@
 
 constexpr int32_t kHlskChaosNoisePhsMax = 0x1000000L;
 constexpr int32_t kHlskChaosNoisePhsMsk = 0x0FFFFFFL;
+constexpr int kHlskChaosNoisePhsBits = 24;
 
 /**
  * @brief A noise generator that uses a chaos function to produce sound.
@@ -50,22 +51,31 @@ public:
     void SetFreq(float freq)
     {
         freq_ = freq;
+        inc_ = floor(freq_ * maxlens_);
     }
 
-    float noise()
+    /**
+     * @brief Advances the phase by one sample and the map when it wraps. The
+     *        frequency is below the sample rate, so the phase wraps at most
+     *        once per sample and the carry out of the phase bits tells when.
+     */
+    static inline float Step(float chaos, int32_t inc, int32_t& phs, float* y)
     {
-        phs_ += floor(freq_ * maxlens_);
-
-        if (phs_ >= kHlskChaosNoisePhsMax) {
-            float y;
-
-            phs_ &= kHlskChaosNoisePhsMsk;
-            y = fabs(chaos_ * y_[0] - y_[1] - 0.05f);
-            y_[1] = y_[0];
-            y_[0] = y;
+        phs += inc;
+        if (phs >> kHlskChaosNoisePhsBits)
+        {
+            phs &= kHlskChaosNoisePhsMsk;
+            float n = fabs(chaos * y[0] - y[1] - 0.05f);
+            y[1] = y[0];
+            y[0] = n;
         }
 
-        return y_[0];
+        return y[0];
+    }
+
+    float noise()
+    {
+        return Step(chaos_, inc_, phs_, y_);
     }
 
     void process(AudioBuffer &buffer)
@@ -82,5 +92,75 @@ public:
 private:
     float y_[2];
     float maxlens_, chaos_, freq_;
-    int32_t phs_;
+    int32_t phs_, inc_;
+};
+
+/**
+ * @brief N independent chaos noise generators sharing frequency and chaos,
+ *        rendered together. The lanes start from different values and
+ *        phases, so they don't correlate, i.e. for stereo noise.
+ *
+ * @tparam N Number of lanes
+ */
+template <size_t N>
+class ChaosNoiseBank
+{
+public:
+    ChaosNoiseBank() {}
+    ~ChaosNoiseBank() {}
+
+    /**
+     * @param sampleRate
+     * @param init Initial value of the first lane, must be between 0 and 1
+     */
+    void Init(float sampleRate, float init = 0.f)
+    {
+        for (size_t j = 0; j < N; j++)
+        {
+            y_[j][0] = init + (1.f - init) * j / N;
+            y_[j][1] = 0;
+            phs_[j] = (kHlskChaosNoisePhsMax / N) * j;
+        }
+
+        maxlens_ = kHlskChaosNoisePhsMax / sampleRate;
+
+        SetChaos(1.5f);
+        SetFreq(8000.f);
+    }
+
+    void SetChaos(float chaos)
+    {
+        chaos_ = chaos;
+    }
+
+    float GetFreq()
+    {
+        return freq_;
+    }
+
+    void SetFreq(float freq)
+    {
+        freq_ = freq;
+        inc_ = floor(freq_ * maxlens_);
+    }
+
+    /**
+     * @brief Fills a block for each lane.
+     */
+    void Process(float* const* output, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            for (size_t j = 0; j < N; j++)
+            {
+                output[j][i] = ChaosNoise::Step(chaos_, inc_, phs_[j], y_[j]);
+            }
+        }
+    }
+
+private:
+    float y_[N][2];
+    float maxlens_, chaos_, freq_;
+    int32_t phs_[N];
+    int32_t inc_;
 };
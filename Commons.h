@@ -8,6 +8,8 @@
 #include <cmath>
 
 //#define USE_RECORD_THRESHOLD
+#define USE_ECHO_COMPACT_STORAGE // 16 bits echo lines, twice as long
+#define USE_AMBIENCE_HALF_RATE // Reverb runs at half the sample rate
 #define MAX_PATCH_SETTINGS 16 // Max number of available MIDI channels
 #define PATCH_SETTINGS_NAME "oneiroi"
 #define PATCH_VERSION_MAJOR 1
@@ -52,6 +54,7 @@ const float k2Pi = kPi * 2.0f;
 const float kHPi = kPi * 0.5f;
 constexpr float kSqrt2 = 1.414213562373095f;
 const float kRSqrt2 = 1.f / kSqrt2;
+constexpr float kLog2PerDb = 0.1660964f; // log2(10) / 20, dB to log2 of the amplitude
 constexpr float kOne = 0.975f; //4095.f / 4096.f;
 constexpr float k2One = kOne * 2;
 static const float kOneHalf = kOne / 2.f;
@@ -99,6 +102,8 @@ constexpr int kWaveTableLength = 2048;
 constexpr int kWaveTableNofTables = 32;
 static const int kWaveTableStepLength = kLooperChannelBufferLength / kWaveTableNofTables;
 static const float kWaveTableNofTablesR = 1.f / kWaveTableNofTables;
+constexpr int kWaveTableFrameLength = kWaveTableLength + 1; // One guard sample for interpolation
+constexpr int kWaveTableSnapshotLength = kWaveTableNofTables * kWaveTableFrameLength * 2; // Interleaved
 
 // When internally clocked, base frequency is ~0.18Hz
 // When externally clocked, min bpm is 30 (0.5Hz), max is 300 (5Hz)
@@ -117,11 +122,37 @@ static const float kOscSineFadeInc = 1.f / 2400;
 constexpr float kOScSuperSawGain = 0.4f;
 constexpr float kOScWaveTablePreGain = 6.f;
 constexpr float kOScWaveTableGain = 0.3f;
+constexpr float kOscOversampling2xFreq = 1500.f; // Pitch above which the supersaw and the wavetable are rendered at 2x
+constexpr float kOscOversampling4xFreq = 4000.f; // Pitch above which the supersaw and the wavetable are rendered at 4x
+constexpr float kOscOversamplingHysteresis = 0.9f; // The pitch must go below threshold * this to lower the factor
 constexpr float kSourcesMakeupGain = 0.2f;
 
+constexpr float kDriveMin = 0.001f; // Below this the drive stage is skipped
+constexpr float kDriveAmount = 0.005f; // Maximum amount of the driven signal
+constexpr float kDriveGain = 600.f;
+constexpr int kDriveOversampling = 4; // 1, 2 or 4
+
+constexpr float kBypassVolThreshold = 0.001f; // Wet level below which an effect is muted
+constexpr float kBypassTailThreshold = 0.0001f; // -80dB
+
+// Prewarped filter cutoffs, see TanLut.h. The table covers 12 octaves below
+// Nyquist in 1/16th of a semitone.
+constexpr int kTanLutStepsPerSemi = 16;
+constexpr int kTanLutSemis = 144;
+constexpr int kTanLutSize = kTanLutSemis * kTanLutStepsPerSemi;
+
 constexpr float kDjFilterMakeupGainMin = 1.f;
 constexpr float kDjFilterMakeupGainMax = 1.4f;
 
+// Filter mode knob: low pass up to kFilterMorphLpEnd, band pass between
+// kFilterMorphBpStart and kFilterMorphBpEnd, high pass from
+// kFilterMorphHpStart and comb from kFilterMorphCombStart, blended in between.
+constexpr float kFilterMorphLpEnd = 0.2f;
+constexpr float kFilterMorphBpStart = 0.3f;
+constexpr float kFilterMorphBpEnd = 0.45f;
+constexpr float kFilterMorphHpStart = 0.55f;
+constexpr float kFilterMorphCombStart = 0.75f;
+
 constexpr float kFilterFreqMin = 10.f;
 constexpr float kFilterFreqMax = 22000.f;
 constexpr float kFilterMakeupGain = 2.4f;
@@ -132,6 +163,7 @@ constexpr float kFilterHpGainMin = 0.2f;
 constexpr float kFilterHpGainMax = 0.4f;
 constexpr float kFilterBpGainMin = 0.2f;
 constexpr float kFilterBpGainMax = 0.4f;
+constexpr int kFilterCombLineSize = 1024; // Power of two, twice the longest period plus the interpolation points
 constexpr float kFilterCombGainMin = 0.1f;
 constexpr float kFilterCombGainMax = 0.2f;
 
@@ -139,26 +171,49 @@ constexpr float kResoGainMin = 0.5f;
 constexpr float kResoGainMax = 1.2f;
 constexpr float kResoMakeupGain = 1.f;
 constexpr int32_t kResoBufferSize = 2400;
+constexpr int kResoPoles = 3;
+constexpr int kResoLanes = 4; // Stereo first pole, mono second and third
+constexpr size_t kResoLineSize = 4096; // Power of 2 above kResoBufferSize
+constexpr size_t kResoTuneInterval = 16; // Samples between two retunes of the poles
+constexpr float kResoPoleRoot = 17.667f; // Pole note of C3, the center of the tune knob
+constexpr int kResoMidiRoot = 48; // C3
+constexpr int kResoMaxVoices = 8; // Notes played at once in bank mode
+constexpr float kResoReleaseFeedback = 0.95f; // Feedback of a released voice, relative to the knob
+constexpr float kResoLutMin = -64.f; // Pole note range, wider than what the tune and dissonance knobs reach
+constexpr float kResoLutMax = 64.f;
+constexpr int kResoLutSize = int(kResoLutMax - kResoLutMin) * 16 + 1; // 1/16th of a semitone
+constexpr float kResoRetuneTolerance = 1.0036f; // Cutoff ratio below which the pole filters aren't recomputed, 1/16th of a semitone
 constexpr float kResoInfiniteFeedbackThreshold = 0.999f;
 constexpr float kResoInfiniteFeedbackLevel = 1.001f;
 
 constexpr int32_t kEchoFadeSamples = 2400; // 50 ms @ audio rate
 constexpr int32_t kEchoMinLengthSamples = 480; // 10 ms @ audio rate
-constexpr int32_t kEchoMaxLengthSamples = 192000; // 4 seconds @ audio rate
-constexpr int kEchoTaps = 4;
-const float kEchoTapsRatios[kEchoTaps] = { 0.75f, 0.25f, 0.375f, 1.f };  // TAP_LEFT_A (1/2 dot), TAP_LEFT_B (1/8), TAP_RIGHT_A (1/8 dot), TAP_RIGHT_B (1)
-const float kEchoTapsFeedbacks[kEchoTaps] = { 0.35f, 0.65f, 0.55f, 0.45f };
+#ifdef USE_ECHO_COMPACT_STORAGE
+constexpr int32_t kEchoMaxLengthSamples = 768000; // 16 seconds @ audio rate
+#else
+constexpr int32_t kEchoMaxLengthSamples = 384000; // 8 seconds @ audio rate
+#endif
+constexpr int kEchoMaxTaps = 16;
+constexpr float kEchoDensitySmoothing = 4.f / kEchoFadeSamples; // Per sample
 const int32_t kEchoMaxExternalClockSamples = kEchoMaxLengthSamples / kModClockRatios[kClockNofRatios - 1]; // Maximum period for the external clock
 constexpr int kEchoExternalClockMultiplier = 32;
-constexpr int kEchoInternalClockMultiplier = 23; // ~192000 / 8192 (period of the buffer)
+constexpr int kEchoInternalClockMultiplier = 46; // ~384000 / 8192 (period of the buffer), the longer lines are for the external clock
 constexpr float kEchoInfiniteFeedbackThreshold = 0.999f;
 constexpr float kEchoInfiniteFeedbackLevel = 1.001f;
 constexpr int kEchoCompThresMin = -16;
 constexpr int kEchoCompThresMax = -22;
 constexpr float kEchoMakeupGain = 1.2f;
+constexpr float kCompactDelayRange = 3.f; // Range of the 16 bits delay lines, the reads are clamped to it anyway
 
-constexpr int32_t kAmbienceBufferSize = 48000;
+#ifdef USE_AMBIENCE_HALF_RATE
+constexpr int kAmbienceRateDivider = 2;
+#else
+constexpr int kAmbienceRateDivider = 1;
+#endif
+constexpr int32_t kAmbienceBufferSize = 48000 / kAmbienceRateDivider; // 1 second @ reverb rate
 constexpr int kAmbienceNofDiffusers = 4;
+constexpr int kAmbienceNofLanes = kAmbienceNofDiffusers * 2;
+constexpr float kAmbienceDiffusionWidth = 0.1f; // Rotation between the channels, 0 keeps them apart
 constexpr float kAmbienceLowDampMin = -0.5f;
 constexpr float kAmbienceLowDampMax = -40.f;
 constexpr float kAmbienceHighDampMin = -0.5f;
@@ -181,6 +236,158 @@ constexpr int kSaveLimit = 3000; // Samples waited for MOD/CV button to be press
 constexpr int kGateLimit = 750; // Samples waited for a button gate to go off - 500ms (1500 = 1s @ block rate)
 constexpr int kHoldLimit = 75; // Samples waited for a pressed button to be considered held - 50ms (1500 = 1s @ block rate)
 
+enum QualityLevel
+{
+    QUALITY_FULL,
+    QUALITY_HIGH,
+    QUALITY_MEDIUM,
+    QUALITY_LOW,
+    QUALITY_LAST
+};
+
+constexpr float kQualityLoadHigh = 0.85f; // Fraction of the block time
+constexpr float kQualityLoadLow = 0.65f;
+constexpr float kQualityLoadRelease = 0.995f;
+constexpr int kQualityHoldBlocks = 150; // Blocks waited before lowering the quality again - 100ms (1500 = 1s @ block rate)
+constexpr int kQualityRestoreBlocks = 3000; // Blocks with headroom required to raise the quality - 2s (1500 = 1s @ block rate)
+const int kQualitySuperSawVoices[QUALITY_LAST] = { 7, 7, 5, 3 };
+const int kQualitySprayGrains[QUALITY_LAST] = { 8, 4, 4, 2 };
+const int kQualityOscOversampling[QUALITY_LAST] = { 4, 4, 2, 1 }; // Maximum factor
+const int kQualityDriveOversampling[QUALITY_LAST] = { 4, 2, 2, 1 }; // Maximum factor
+const int kQualityCombInterpolation[QUALITY_LAST] = { 4, 4, 2, 2 }; // Points, 4 is Hermite, 2 linear
+
+/**
+ * @brief Notes held on the MIDI input, in the order they were played. When
+ *        it's full the oldest note is dropped.
+ */
+class NoteStack
+{
+private:
+    uint8_t notes_[kResoMaxVoices];
+    size_t size_;
+
+public:
+    NoteStack()
+    {
+        size_ = 0;
+    }
+    ~NoteStack() {}
+
+    void NoteOn(uint8_t note)
+    {
+        NoteOff(note);
+        if (kResoMaxVoices == size_)
+        {
+            NoteOff(notes_[0]);
+        }
+        notes_[size_++] = note;
+    }
+
+    void NoteOff(uint8_t note)
+    {
+        for (size_t i = 0; i < size_; i++)
+        {
+            if (note == notes_[i])
+            {
+                for (size_t j = i + 1; j < size_; j++)
+                {
+                    notes_[j - 1] = notes_[j];
+                }
+                size_--;
+
+                return;
+            }
+        }
+    }
+
+    void Clear()
+    {
+        size_ = 0;
+    }
+
+    bool Contains(int note) const
+    {
+        for (size_t i = 0; i < size_; i++)
+        {
+            if (note == notes_[i])
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    uint8_t Note(size_t i) const
+    {
+        return notes_[i];
+    }
+};
+
+/**
+ * @brief A set of echo taps. Each one reads one of the two delay lines at a
+ *        fraction of the echo time, feeds one of them back and goes to one
+ *        of the outputs.
+ */
+struct EchoVoicing
+{
+    int taps;
+    float ratios[kEchoMaxTaps]; // Fraction of the echo time
+    float feedbacks[kEchoMaxTaps];
+    uint8_t lines[kEchoMaxTaps]; // Line read
+    uint8_t sends[kEchoMaxTaps]; // Line fed back into
+    uint8_t outs[kEchoMaxTaps]; // Output channel
+    float mix; // Output gain
+};
+
+enum EchoVoicingType
+{
+    ECHO_VOICING_CLASSIC,
+    ECHO_VOICING_RHYTHMIC,
+    ECHO_VOICING_DIFFUSE,
+    ECHO_VOICING_LAST
+};
+
+const EchoVoicing kEchoVoicings[ECHO_VOICING_LAST] = {
+    // Two taps for each channel: 1/2 dot and 1/8 on the left, 1/8 dot and 1
+    // on the right, the first ones feed the left line and the second ones
+    // the right line.
+    {
+        4,
+        { 0.75f, 0.25f, 0.375f, 1.f },
+        { 0.35f, 0.65f, 0.55f, 0.45f },
+        { LEFT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, RIGHT_CHANNEL },
+        { LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL },
+        { LEFT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, RIGHT_CHANNEL },
+        0.707f,
+    },
+    // Eighths bouncing between the channels.
+    {
+        8,
+        { 0.125f, 0.25f, 0.375f, 0.5f, 0.625f, 0.75f, 0.875f, 1.f },
+        { 0.3f, 0.2f, 0.3f, 0.2f, 0.25f, 0.25f, 0.25f, 0.25f },
+        { LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL },
+        { RIGHT_CHANNEL, LEFT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL },
+        { LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL },
+        0.5f,
+    },
+    // Irregular taps that smear into a cloud.
+    {
+        16,
+        { 0.07f, 0.11f, 0.16f, 0.22f, 0.29f, 0.35f, 0.42f, 0.5f, 0.57f, 0.63f, 0.7f, 0.76f, 0.83f, 0.88f, 0.94f, 1.f },
+        { 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f },
+        { LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL },
+        { RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL },
+        { LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL },
+        0.354f,
+    },
+};
+
 struct PatchCtrls
 {
     float inputVol;
@@ -245,6 +452,7 @@ struct PatchCtrls
     float echoDensityModAmount;
     float echoDensityCvAmount;
     float echoFilter;
+    float echoVoicing;
 
     float ambienceVol;
     float ambienceDecay;
@@ -355,6 +563,10 @@ struct PatchState
     FuncMode funcMode;
 
     StartupPhase startupPhase;
+
+    QualityLevel qualityLevel;
+
+    NoteStack heldNotes;
 };
 
 inline bool AreEquals(float val1, float val2, float d = kEps)
@@ -581,6 +793,33 @@ inline int QuantizeInt(float value, int32_t steps)
     return rintf(Clamp(value, 0, 1) * (steps - 1));
 }
 
+/**
+ * @brief Oversampling factor for the oscillators at a given pitch, with
+ *        some hysteresis to avoid switching back and forth.
+ *
+ * @param freq Pitch of the oscillator
+ * @param factor The current factor
+ * @param maxFactor Maximum factor allowed
+ * @return int 1, 2 or 4
+ */
+inline int OscOversamplingFactor(float freq, int factor, int maxFactor)
+{
+    float h2 = factor >= 2 ? kOscOversamplingHysteresis : 1.f;
+    float h4 = factor >= 4 ? kOscOversamplingHysteresis : 1.f;
+
+    int f = 1;
+    if (freq > kOscOversampling4xFreq * h4)
+    {
+        f = 4;
+    }
+    else if (freq > kOscOversampling2xFreq * h2)
+    {
+        f = 2;
+    }
+
+    return f > maxFactor ? maxFactor : f;
+}
+
 // (a + b) * 1 / sqrt(2)
 inline float Mix2(float a, float b)
 {
@@ -616,6 +855,20 @@ inline float Db2A(float db)
     return Power(10.f, db / 20.f);
 }
 
+/**
+ * @brief 4-point, 3rd-order Hermite interpolation between x0 and x1.
+ */
+inline float HermiteInterpolate(float xm1, float x0, float x1, float x2, float t)
+{
+    float c = (x1 - xm1) * 0.5f;
+    float v = x0 - x1;
+    float w = c + v;
+    float a = w + v + (x2 - x0) * 0.5f;
+    float b = w + a;
+
+    return (((a * t) - b) * t + c) * t + x0;
+}
+
 inline float LinearCrossFade(float a, float b, float pos)
 {
     return a * (1.f - pos) + b * pos;
@@ -908,6 +1161,44 @@ public:
     }
 };
 
+/**
+ * @brief A function sampled evenly between min and max and read with linear
+ *        interpolation, for smooth curves evaluated at audio rate. Inputs
+ *        outside the range are clamped.
+ */
+template<int size>
+class InterpolatedLut
+{
+private:
+    float lut_[size];
+    float min_;
+    float max_;
+    float scale_;
+
+public:
+    InterpolatedLut(float (*function)(float), float min, float max) : min_{min}, max_{max}
+    {
+        scale_ = (size - 1) / (max_ - min_);
+        for (int i = 0; i < size; i++)
+        {
+            lut_[i] = function(min_ + i / scale_);
+        }
+    }
+    ~InterpolatedLut() {}
+
+    inline float Interpolate(float x) const
+    {
+        float pos = (Clamp(x, min_, max_) - min_) * scale_;
+        int i = int(pos);
+        if (i >= size - 1)
+        {
+            return lut_[size - 1];
+        }
+
+        return lut_[i] + (lut_[i + 1] - lut_[i]) * (pos - i);
+    }
+};
+
 // These is taken and adapted from code found in Emilie Gillet's eurorack repo.
 float Modulate(
     float baseValue,
@@ -4,60 +4,62 @@
 #include "Commons.h"
 
 /**
- * https://git.iem.at/audioplugins/IEMPluginSuite/blob/master/resources/Compressor.h
+ * @brief Peak compressor for both channels at once, on a whole block, after
+ *        https://git.iem.at/audioplugins/IEMPluginSuite/blob/master/resources/Compressor.h
+ *        Below the threshold the envelopes only go through a linear
+ *        compare, above it they are compared with it in the log2 domain and
+ *        the gain is just a fast_exp2f. The threshold glides over the block
+ *        instead of being held with a hysteresis.
+ *        When linked, both channels follow the loudest one and the image
+ *        doesn't shift.
  */
-class Compressor
+class StereoCompressor
 {
 private:
     float sampleRate_;
-    float threshold_;
     float ratio_, expo_;
-    float attack_;
-    float release_;
+    float attack_, release_;
+    float cteAT_, cteRL_;
 
-    // Internal variables
-    float thrlin_, thrlinr_;
-    float cteAT_;
-    float cteRL_;
+    float threshold_, newThreshold_; // log2 of the amplitude
+    float thrLin_, newThrLin_;
+    bool link_;
 
-    // State variables
-    float leftS1_ = 0.f, rightS1_ = 0.f;
+    float s1_[2];
 
 public:
-    Compressor(float sampleRate)
+    StereoCompressor(float sampleRate)
     {
         sampleRate_ = sampleRate;
+        s1_[0] = s1_[1] = 0;
+        link_ = false;
 
         setRatio(4.f);
         setAttack(1.f);
         setRelease(100.f);
         setThreshold(-10.f);
-    };
-    ~Compressor()
-    {
-
-    };
+        threshold_ = newThreshold_;
+        thrLin_ = newThrLin_;
+    }
+    ~StereoCompressor() {}
 
-    static Compressor* create(float sampleRate)
+    static StereoCompressor* create(float sampleRate)
     {
-        return new Compressor(sampleRate);
+        return new StereoCompressor(sampleRate);
     }
 
-    static void destroy(Compressor* obj)
+    static void destroy(StereoCompressor* obj)
     {
         delete obj;
     }
 
+    /**
+     * @param value dB, reached at the end of the next block
+     */
     void setThreshold(float value)
     {
-        if (fabs(value - threshold_) < 1.f)
-        {
-            return;
-        }
-
-        threshold_ = value;
-        thrlin_ = Db2A(threshold_);
-        thrlinr_ = 1.f / thrlin_;
+        newThreshold_ = value * kLog2PerDb;
+        newThrLin_ = Db2A(value);
     }
 
     void setRatio(float value)
@@ -78,52 +80,54 @@ public:
         cteRL_ = exp (-2.f * M_PI * 1000.f / release_ / sampleRate_);
     }
 
-    float process(float input)
+    void setLink(bool link)
     {
-        float leftSideInput = fabs(input);
-
-        // Ballistics filter and envelope generation
-        float leftCte = (leftSideInput >= leftS1_ ? cteAT_ : cteRL_);
-        float leftEnv = leftSideInput + leftCte * (leftS1_ - leftSideInput);
-        leftS1_ = leftEnv;
-
-        // Compressor transfer function
-        float leftCv = (leftEnv <= thrlin_ ? 1.f : fast_powf(leftEnv * thrlinr_, expo_));
-
-        // Processing
-        return input * leftCv;
+        link_ = link;
     }
 
     void process(AudioBuffer &input, AudioBuffer &output)
     {
-        int size = input.getSize();
-        FloatArray leftIn = input.getSamples(0);
-        FloatArray rightIn = input.getSamples(1);
-        FloatArray leftOut = output.getSamples(0);
-        FloatArray rightOut = output.getSamples(1);
+        size_t size = input.getSize();
+        float* in[2] = { input.getSamples(0).getData(), input.getSamples(1).getData() };
+        float* out[2] = { output.getSamples(0).getData(), output.getSamples(1).getData() };
+
+        float inc = (newThreshold_ - threshold_) / size;
+        // Same glide as the log2 threshold.
+        float mul = fast_exp2f(inc);
 
-        for (int i = 0; i < size; i++)
+        for (size_t i = 0; i < size; i++)
         {
-            // Detector (peak)
-            float leftSideInput = abs(leftIn[i]);
-            float rightSideInput = abs(rightIn[i]);
+            threshold_ += inc;
+            thrLin_ *= mul;
 
             // Ballistics filter and envelope generation
-            float leftCte = (leftSideInput >= leftS1_ ? cteAT_ : cteRL_);
-            float leftEnv = leftSideInput + leftCte * (leftS1_ - leftSideInput);
-            leftS1_ = leftEnv;
-
-            float rightCte = (rightSideInput >= rightS1_ ? cteAT_ : cteRL_);
-            float rightEnv = rightSideInput + rightCte * (rightS1_ - rightSideInput);
-            rightS1_ = rightEnv;
+            float env[2];
+            for (size_t c = 0; c < 2; c++)
+            {
+                float x = fabsf(in[c][i]);
+                float cte = (x >= s1_[c] ? cteAT_ : cteRL_);
+                s1_[c] = x + cte * (s1_[c] - x);
+                env[c] = s1_[c];
+            }
+            if (link_)
+            {
+                env[0] = env[1] = Max(env[0], env[1]);
+            }
 
             // Compressor transfer function
-            float leftCv = (leftEnv <= thrlin_ ? 1.f : fast_powf(leftEnv / thrlin_, expo_));
-            float rightCv = (rightEnv <= thrlin_ ? 1.f : fast_powf(rightEnv / thrlin_, expo_));
-
-            // Processing
-            leftOut[i] = leftIn[i] * leftCv;
-            rightOut[i] = rightIn[i] * rightCv;
+            for (size_t c = 0; c < 2; c++)
+            {
+                float cv = 1.f;
+                if (env[c] > thrLin_)
+                {
+                    float over = fast_log2f(env[c]) - threshold_;
+                    cv = (over > 0 ? fast_exp2f(over * expo_) : 1.f);
+                }
+                out[c][i] = in[c][i] * cv;
+            }
         }
+
+        threshold_ = newThreshold_;
+        thrLin_ = newThrLin_;
     }
 };
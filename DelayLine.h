@@ -4,6 +4,10 @@
 #include "Interpolator.h"
 #include <stdint.h>
 
+/**
+ * @brief The samples are clamped to ±3 when they're written, so the reads
+ *        are just loads.
+ */
 class DelayLine
 {
 private:
@@ -51,7 +55,7 @@ public:
             i += size_;
         }
 
-        return Clamp(buffer_[i], -3.f, 3.f);
+        return buffer_[i];
     }
 
     inline float read(float index)
@@ -77,11 +81,98 @@ public:
 
     inline void write(float value, int stride = 1)
     {
-        buffer_[writeIndex_] = value;
+        buffer_[writeIndex_] = Clamp(value, -3.f, 3.f);
         writeIndex_ += stride;
         if  (writeIndex_ >= size_)
         {
             writeIndex_ -= size_;
         }
     }
-};
\ No newline at end of file
+};
+
+/**
+ * @brief Same as DelayLine, but the samples are stored as 16 bits fixed point
+ *        over the range the reads are clamped to, so it takes half the
+ *        memory. The resolution is about 80dB below full scale.
+ */
+class CompactDelayLine
+{
+private:
+    ShortArray buffer_;
+    uint32_t size_, writeIndex_;
+
+    static constexpr float kEncode = INT16_MAX / kCompactDelayRange;
+    static constexpr float kDecode = kCompactDelayRange / INT16_MAX;
+
+public:
+    CompactDelayLine(uint32_t size)
+    {
+        size_ = size;
+        buffer_ = ShortArray::create(size_);
+        buffer_.clear();
+        writeIndex_ = 0;
+    }
+    ~CompactDelayLine()
+    {
+        ShortArray::destroy(buffer_);
+    }
+
+    static CompactDelayLine* create(uint32_t size)
+    {
+        return new CompactDelayLine(size);
+    }
+
+    static void destroy(CompactDelayLine* line)
+    {
+        delete line;
+    }
+
+    void clear()
+    {
+        buffer_.clear();
+    }
+
+    inline float readAt(int index)
+    {
+        int i = writeIndex_ - index - 1;
+        if (i < 0)
+        {
+            i += size_;
+        }
+
+        return buffer_[i] * kDecode;
+    }
+
+    inline float read(float index)
+    {
+        size_t idx = (size_t)index;
+        float y0 = readAt(idx);
+        float y1 = readAt(idx + 1);
+        float frac = index - idx;
+
+        return Interpolator::linear(y0, y1, frac);
+    }
+
+    inline float read(float index1, float index2, float x)
+    {
+        float v = read(index1);
+        if (x == 0)
+        {
+            return v;
+        }
+
+        return v * (1.f - x) + read(index2) * x;
+    }
+
+    inline void write(float value, int stride = 1)
+    {
+        // Rounded, truncating would bias the feedback towards 0.
+        float v = Clamp(value, -kCompactDelayRange, kCompactDelayRange) * kEncode;
+        buffer_[writeIndex_] = static_cast<int16_t>(v < 0 ? v - 0.5f : v + 0.5f);
+        writeIndex_ += stride;
+        if  (writeIndex_ >= size_)
+        {
+            writeIndex_ -= size_;
+        }
+    }
+};
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "Commons.h"
-#include "StateVariableFilter.h"
+#include "PackedStateVariableFilter.h"
 
 class DjFilter
 {
@@ -13,11 +13,12 @@ private:
         HP,
     };
 
-    StateVariableFilter* lpfs_[2];
-    StateVariableFilter* hpfs_[2];
+    // Low and high pass share the same state, only the output mix changes.
+    PackedStateVariableFilter<2>* filter_;
 
-    FilterType filter_ = FilterType::NO_FILTER;
+    FilterType type_ = FilterType::NO_FILTER;
     
+    float value_;
     float freq_;
     float lpfMix_;
     float hpfMix_;
@@ -25,15 +26,13 @@ private:
 
     void UpdateFilter()
     {
-        switch (filter_)
+        switch (type_)
         {
         case FilterType::LP:
-            lpfs_[LEFT_CHANNEL]->setLowPass(freq_, 0.55f);
-            lpfs_[RIGHT_CHANNEL]->setLowPass(freq_, 0.55f);
+            filter_->SetLowPass(freq_, 0.55f);
             break;
         case FilterType::HP:
-            hpfs_[LEFT_CHANNEL]->setHighPass(freq_, 0.55f);
-            hpfs_[RIGHT_CHANNEL]->setHighPass(freq_, 0.55f);
+            filter_->SetHighPass(freq_, 0.55f);
             break;
 
         default:
@@ -44,24 +43,17 @@ private:
 public:
     DjFilter(float sampleRate)
     {
-        for (size_t i = 0; i < 2; i++)
-        {
-            lpfs_[i] = StateVariableFilter::create(sampleRate);
-            hpfs_[i] = StateVariableFilter::create(sampleRate);
-        }
+        filter_ = PackedStateVariableFilter<2>::create(sampleRate);
 
-        filter_ = FilterType::NO_FILTER;
+        type_ = FilterType::NO_FILTER;
+        value_ = -1.f;
         lpfMix_ = 1.f;
         hpfMix_ = 0.f;
         amp_ = 1.f;
     }
     ~DjFilter()
     {
-        for (size_t i = 0; i < 2; i++)
-        {
-            StateVariableFilter::destroy(lpfs_[i]);
-            StateVariableFilter::destroy(hpfs_[i]);
-        }
+        PackedStateVariableFilter<2>::destroy(filter_);
     }
 
     static DjFilter* create(float sampleRate)
@@ -76,9 +68,15 @@ public:
 
     void SetFilter(float value)
     {
+        if (value == value_)
+        {
+            return;
+        }
+        value_ = value;
+
         if (value <= 0.45f)
         {
-            filter_ = FilterType::LP;
+            type_ = FilterType::LP;
             lpfMix_ = Map(value, 0.f, 0.45f, 0.f, 1.f);
             freq_ = Map(lpfMix_, 0.f, 1.f, 500.f, 2000.f);
             UpdateFilter();
@@ -86,7 +84,7 @@ public:
         }
         else if (value >= 0.55f)
         {
-            filter_ = FilterType::HP;
+            type_ = FilterType::HP;
             hpfMix_ = Map(value, 0.55f, 1.f, 0.f, 1.f);
             freq_ = Map(hpfMix_, 0.f, 1.f, 1000.f, 4000.f);
             UpdateFilter();
@@ -94,26 +92,33 @@ public:
         }
         else
         {
-            filter_ = FilterType::NO_FILTER;
+            type_ = FilterType::NO_FILTER;
         }
     }
 
     void Process(float leftIn, float rightIn, float &leftOut, float &rightOut)
     {
-        switch (filter_)
+        if (FilterType::NO_FILTER == type_)
         {
-        case FilterType::LP:
-            leftOut = LinearCrossFade(lpfs_[LEFT_CHANNEL]->process(leftIn), leftIn, lpfMix_);
-            rightOut = LinearCrossFade(lpfs_[RIGHT_CHANNEL]->process(rightIn), rightIn, lpfMix_);
-            break;
-        case FilterType::HP:
-            leftOut = LinearCrossFade(leftIn, hpfs_[LEFT_CHANNEL]->process(leftIn), hpfMix_);
-            rightOut = LinearCrossFade(rightIn, hpfs_[RIGHT_CHANNEL]->process(rightIn), hpfMix_);
-            break;
-        default:
-            leftOut = leftIn;
-            rightOut = rightIn;
-            break;
+            leftOut = Clamp(leftIn, -3.f, 3.f);
+            rightOut = Clamp(rightIn, -3.f, 3.f);
+
+            return;
+        }
+
+        float in[2] = {leftIn, rightIn};
+        float out[2];
+        filter_->Process(in, out);
+
+        if (FilterType::LP == type_)
+        {
+            leftOut = LinearCrossFade(out[LEFT_CHANNEL], leftIn, lpfMix_);
+            rightOut = LinearCrossFade(out[RIGHT_CHANNEL], rightIn, lpfMix_);
+        }
+        else
+        {
+            leftOut = LinearCrossFade(leftIn, out[LEFT_CHANNEL], hpfMix_);
+            rightOut = LinearCrossFade(rightIn, out[RIGHT_CHANNEL], hpfMix_);
         }
 
         leftOut = Clamp(leftOut, -3.f, 3.f);
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "Commons.h"
+#include "HalfBand.h"
+#include "Adaa.h"
+
+/**
+ * @brief Amp-style distortion placed before the echo: the signal is driven
+ *        hard into a soft clipper and a small amount of it is mixed with the
+ *        clean one. The clipper runs at 2x or 4x the sample rate to keep the
+ *        aliasing down, and the mix is done there too so that the clean and
+ *        the driven signals go through the same filters.
+ */
+class Drive
+{
+private:
+    PatchCtrls* patchCtrls_;
+    PatchState* patchState_;
+
+    StereoInterpolator* interpolator_;
+    StereoDecimator* decimator_;
+    StereoInterpolator* fadeInterpolator_;
+    StereoDecimator* fadeDecimator_;
+
+    AudioBuffer* oversampled_;
+    AudioBuffer* dry_;
+    AudioBuffer* fade_;
+
+    Adaa1<SoftClipShape> clip_;
+
+    int factor_;
+
+    bool active_;
+    float xi_;
+
+    /**
+     * @brief Drives the dry signal at the given factor into the output.
+     */
+    void Render(AudioBuffer &output, int factor, float amount, StereoInterpolator* interpolator, StereoDecimator* decimator)
+    {
+        interpolator->Process(*dry_, *oversampled_, factor);
+
+        float* left = oversampled_->getSamples(LEFT_CHANNEL).getData();
+        float* right = oversampled_->getSamples(RIGHT_CHANNEL).getData();
+        size_t n = output.getSize() * factor;
+        if (1 == factor)
+        {
+            // Without oversampling, at least use the antialiased clipper. It
+            // delays the wet signal by half a sample, the dry one is left
+            // alone: with the small drive amount the comb filtering stays
+            // well below audible.
+            for (size_t i = 0; i < n; i++)
+            {
+                float l = left[i];
+                float r = right[i];
+                left[i] = LinearCrossFade(l, clip_.Process(LEFT_CHANNEL, l * kDriveGain), amount);
+                right[i] = LinearCrossFade(r, clip_.Process(RIGHT_CHANNEL, r * kDriveGain), amount);
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                float l = left[i];
+                float r = right[i];
+                left[i] = LinearCrossFade(l, SoftClip(l * kDriveGain), amount);
+                right[i] = LinearCrossFade(r, SoftClip(r * kDriveGain), amount);
+            }
+        }
+
+        decimator->Process(*oversampled_, output, factor);
+    }
+
+public:
+    Drive(PatchCtrls* patchCtrls, PatchState* patchState)
+    {
+        patchCtrls_ = patchCtrls;
+        patchState_ = patchState;
+
+        interpolator_ = StereoInterpolator::create(patchState_->blockSize);
+        decimator_ = StereoDecimator::create(patchState_->blockSize);
+        fadeInterpolator_ = StereoInterpolator::create(patchState_->blockSize);
+        fadeDecimator_ = StereoDecimator::create(patchState_->blockSize);
+        oversampled_ = AudioBuffer::create(2, patchState_->blockSize * 4);
+        dry_ = AudioBuffer::create(2, patchState_->blockSize);
+        fade_ = AudioBuffer::create(2, patchState_->blockSize);
+        xi_ = 1.f / patchState_->blockSize;
+
+        factor_ = kDriveOversampling;
+        active_ = false;
+    }
+    ~Drive()
+    {
+        StereoInterpolator::destroy(interpolator_);
+        StereoDecimator::destroy(decimator_);
+        StereoInterpolator::destroy(fadeInterpolator_);
+        StereoDecimator::destroy(fadeDecimator_);
+        AudioBuffer::destroy(oversampled_);
+        AudioBuffer::destroy(dry_);
+        AudioBuffer::destroy(fade_);
+    }
+
+    static Drive* create(PatchCtrls* patchCtrls, PatchState* patchState)
+    {
+        return new Drive(patchCtrls, patchState);
+    }
+
+    static void destroy(Drive* obj)
+    {
+        delete obj;
+    }
+
+    void process(AudioBuffer &input, AudioBuffer &output)
+    {
+        bool active = patchCtrls_->filterDrive > kDriveMin;
+
+        // Skip the stage entirely, but run one more block after the drive
+        // has been turned off to fade out.
+        if (!active && !active_)
+        {
+            if (&input != &output)
+            {
+                output.copyFrom(input);
+            }
+
+            return;
+        }
+
+        size_t size = input.getSize();
+
+        for (size_t c = 0; c < 2; c++)
+        {
+            float* in = input.getSamples(c).getData();
+            float* dry = dry_->getSamples(c).getData();
+            for (size_t i = 0; i < size; i++)
+            {
+                dry[i] = Clamp(in[i], -3.f, 3.f);
+            }
+        }
+
+        // The quality governor may lower the factor.
+        int maxFactor = kQualityDriveOversampling[patchState_->qualityLevel];
+        int factor = kDriveOversampling > maxFactor ? maxFactor : kDriveOversampling;
+        float amount = patchCtrls_->filterDrive * kDriveAmount;
+
+        if (!active_)
+        {
+            // The stage starts from scratch, it's crossfaded with the dry
+            // signal below.
+            interpolator_->Reset();
+            decimator_->Reset();
+            factor_ = factor;
+        }
+
+        if (factor == factor_)
+        {
+            Render(output, factor_, amount, interpolator_, decimator_);
+        }
+        else
+        {
+            // The quality governor changed the factor: process the block at
+            // both factors, from the same state, and crossfade them.
+            fadeInterpolator_->CopyFrom(*interpolator_);
+            fadeDecimator_->CopyFrom(*decimator_);
+            Adaa1<SoftClipShape> clip = clip_;
+            Render(output, factor_, amount, fadeInterpolator_, fadeDecimator_);
+
+            clip_ = clip;
+            Render(*fade_, factor, amount, interpolator_, decimator_);
+
+            for (size_t c = 0; c < 2; c++)
+            {
+                float* out = output.getSamples(c).getData();
+                float* in = fade_->getSamples(c).getData();
+                for (size_t i = 0; i < size; i++)
+                {
+                    out[i] = LinearCrossFade(out[i], in[i], (i + 1) * xi_);
+                }
+            }
+            factor_ = factor;
+        }
+
+        // The filters delay the signal a bit, so crossfade with the dry one
+        // when turning the stage on or off.
+        if (active != active_)
+        {
+            float inc = (active ? 1.f : -1.f) / size;
+            for (size_t c = 0; c < 2; c++)
+            {
+                float* out = output.getSamples(c).getData();
+                float* dry = dry_->getSamples(c).getData();
+                float x = active ? 0.f : 1.f;
+                for (size_t i = 0; i < size; i++)
+                {
+                    x += inc;
+                    out[i] = LinearCrossFade(dry[i], out[i], x);
+                }
+            }
+            active_ = active;
+        }
+    }
+};
@@ -4,18 +4,16 @@
 #include "DelayLine.h"
 #include "EnvFollower.h"
 #include "SineOscillator.h"
-#include "ParameterInterpolator.h"
 #include "DjFilter.h"
 #include "Compressor.h"
+#include "Bypass.h"
 #include <stdint.h>
 
-enum EchoTap
-{
-    TAP_LEFT_A,
-    TAP_LEFT_B,
-    TAP_RIGHT_A,
-    TAP_RIGHT_B,
-};
+#ifdef USE_ECHO_COMPACT_STORAGE
+typedef CompactDelayLine EchoDelayLine;
+#else
+typedef DelayLine EchoDelayLine;
+#endif
 
 class Echo
 {
@@ -24,27 +22,39 @@ private:
     PatchCvs* patchCvs_;
     PatchState* patchState_;
 
-    DelayLine* lines_[kEchoTaps];
+    EchoDelayLine* lines_[2]; // All the taps of a channel read the same line
     DjFilter* filter_;
     EnvFollower* ef_[2];
-    Compressor* comp_[2];
+    StereoCompressor* comp_;
+    AudioBuffer* wet_;
+    Bypass* bypass_;
 
     HysteresisQuantizer densityQuantizer_;
+    HysteresisQuantizer voicingQuantizer_;
 
     int clockRatiosIndex_;
-    float echoDensity_, oldDensity_;
+    float echoDensity_, oldDensity_, densityDecay_;
+
+    const EchoVoicing* voicing_;
+    const EchoVoicing* oldVoicing_;
 
-    float levels_[kEchoTaps], outs_[kEchoTaps];
-    float tapsTimes_[kEchoTaps], newTapsTimes_[kEchoTaps], maxTapsTimes_[kEchoTaps];
-    float repeats_, filterValue_;
+    float tapsTimes_[kEchoMaxTaps], newTapsTimes_[kEchoMaxTaps], maxTapsTimes_[kEchoMaxTaps];
+    float tapsIncs_[kEchoMaxTaps], tapsRatios_[kEchoMaxTaps];
+    float repeats_, feedback_, filterValue_;
     float xi_;
 
     bool externalClock_;
     bool infinite_;
 
+    inline float ClampTapTime(int idx, float time)
+    {
+        return Clamp(time, kEchoMinLengthSamples * voicing_->ratios[idx], (kEchoMaxLengthSamples - 1) * voicing_->ratios[idx]);
+    }
+
     void SetTapTime(int idx, float time)
     {
-        newTapsTimes_[idx] = Clamp(time, kEchoMinLengthSamples * kEchoTapsRatios[idx], (kEchoMaxLengthSamples - 1) * kEchoTapsRatios[idx]);
+        newTapsTimes_[idx] = ClampTapTime(idx, time);
+        tapsIncs_[idx] = 0;
     }
 
     void SetMaxTapTime(int idx, float time)
@@ -53,11 +63,6 @@ private:
         SetTapTime(idx, Max(echoDensity_ * maxTapsTimes_[idx], kEchoMinLengthSamples));
     }
 
-    void SetLevel(int idx, float value)
-    {
-        levels_[idx] = value;
-    }
-
     void SetFilter(float value)
     {
         filterValue_ = value;
@@ -83,14 +88,10 @@ private:
             r = 1.f;
         }
 
-        SetLevel(TAP_LEFT_A, r * kEchoTapsFeedbacks[TAP_LEFT_A]);
-        SetLevel(TAP_LEFT_B, r * kEchoTapsFeedbacks[TAP_LEFT_B]);
-        SetLevel(TAP_RIGHT_A, r * kEchoTapsFeedbacks[TAP_RIGHT_A]);
-        SetLevel(TAP_RIGHT_B, r * kEchoTapsFeedbacks[TAP_RIGHT_B]);
+        feedback_ = r;
 
         float thrs = Map(repeats_, 0.f, 1.f, kEchoCompThresMin, kEchoCompThresMax);
-        comp_[LEFT_CHANNEL]->setThreshold(thrs);
-        comp_[RIGHT_CHANNEL]->setThreshold(thrs);
+        comp_->setThreshold(thrs);
     }
 
     void SetDensity(float value)
@@ -105,9 +106,9 @@ private:
             clockRatiosIndex_ = newIndex;
 
             float d = kModClockRatios[clockRatiosIndex_] * patchState_->clockSamples * kEchoExternalClockMultiplier;
-            for (size_t i = 0; i < kEchoTaps; i++)
+            for (int i = 0; i < voicing_->taps; i++)
             {
-                SetTapTime(i, d * kEchoTapsRatios[i]);
+                SetTapTime(i, d * voicing_->ratios[i]);
             }
 
             // Reset max tap time the next time (...) the clock switches to internal.
@@ -121,9 +122,9 @@ private:
             if (externalClock_)
             {
                 int32_t t = kEchoMaxLengthSamples - 1;
-                for (size_t i = 0; i < kEchoTaps; i++)
+                for (int i = 0; i < voicing_->taps; i++)
                 {
-                    SetMaxTapTime(i, t * kEchoTapsRatios[i]);
+                    SetMaxTapTime(i, t * voicing_->ratios[i]);
                 }
                 externalClock_ = false;
             }
@@ -131,14 +132,50 @@ private:
             echoDensity_ = value;
 
             float d = MapExpo(echoDensity_, 0.f, 1.f, kEchoMinLengthSamples, patchState_->clockSamples * kEchoInternalClockMultiplier);
-            size_t s = kEchoFadeSamples;
-            ParameterInterpolator densityParam(&oldDensity_, d, s);
 
-            for (size_t i = 0; i < kEchoTaps; i++)
+            // The density glides exponentially towards the target, this gives
+            // the pitch shifting. Its value at the end of the block is
+            // computed directly and the taps ramp linearly to it.
+            oldDensity_ = d + (oldDensity_ - d) * densityDecay_;
+
+            for (int i = 0; i < voicing_->taps; i++)
+            {
+                // The ratios glide the same way after a voicing change.
+                tapsRatios_[i] = voicing_->ratios[i] + (tapsRatios_[i] - voicing_->ratios[i]) * densityDecay_;
+                tapsIncs_[i] = (ClampTapTime(i, oldDensity_ * tapsRatios_[i]) - newTapsTimes_[i]) * xi_;
+            }
+        }
+    }
+
+    /**
+     * @brief Reads the taps of a voicing through its feedback and output
+     *        matrices. The old voicing reads its taps where they were before
+     *        the change.
+     */
+    inline void MixTaps(const EchoVoicing* voicing, bool old, float x, float* fb, float* mix)
+    {
+        fb[LEFT_CHANNEL] = fb[RIGHT_CHANNEL] = 0;
+        mix[LEFT_CHANNEL] = mix[RIGHT_CHANNEL] = 0;
+        for (int j = 0; j < voicing->taps; j++)
+        {
+            float out;
+            if (old)
+            {
+                out = lines_[voicing->lines[j]]->read(tapsTimes_[j]);
+            }
+            else if (externalClock_)
             {
-                SetTapTime(i, densityParam.Next() * kEchoTapsRatios[i]);
+                out = lines_[voicing->lines[j]]->read(tapsTimes_[j], newTapsTimes_[j], x);
             }
+            else
+            {
+                out = lines_[voicing->lines[j]]->read(newTapsTimes_[j]);
+            }
+            fb[voicing->sends[j]] += out * feedback_ * voicing->feedbacks[j];
+            mix[voicing->outs[j]] += out;
         }
+        mix[LEFT_CHANNEL] *= voicing->mix;
+        mix[RIGHT_CHANNEL] *= voicing->mix;
     }
 
 public:
@@ -148,44 +185,57 @@ public:
         patchCvs_ = patchCvs;
         patchState_ = patchState;
 
-        for (size_t i = 0; i < kEchoTaps; i++)
+        for (size_t i = 0; i < 2; i++)
+        {
+            lines_[i] = EchoDelayLine::create(kEchoMaxLengthSamples);
+        }
+        voicing_ = &kEchoVoicings[ECHO_VOICING_CLASSIC];
+        oldVoicing_ = voicing_;
+        feedback_ = 0;
+        for (int i = 0; i < kEchoMaxTaps; i++)
         {
-            lines_[i] = DelayLine::create(kEchoMaxLengthSamples);
             tapsTimes_[i] = kEchoMaxLengthSamples - 1;
-            SetMaxTapTime(i, tapsTimes_[i] * kEchoTapsRatios[i]);
-            levels_[i] = 0;
-            outs_[i] = 0;
+            tapsRatios_[i] = voicing_->ratios[i];
+            SetMaxTapTime(i, tapsTimes_[i] * voicing_->ratios[i]);
         }
 
         echoDensity_ = 1.f;
+        oldDensity_ = kEchoMinLengthSamples;
         clockRatiosIndex_ = 0;
 
         xi_ = 1.f / patchState_->blockSize;
 
+        densityDecay_ = powf(1.f - kEchoDensitySmoothing, patchState_->blockSize);
+
         externalClock_ = false;
         infinite_ = false;
 
         filter_ = DjFilter::create(patchState_->sampleRate);
+        bypass_ = Bypass::create(patchState_->blockSize, kEchoMaxLengthSamples);
 
+        comp_ = StereoCompressor::create(patchState_->sampleRate);
+        comp_->setThreshold(-16);
+        wet_ = AudioBuffer::create(2, patchState_->blockSize);
         for (size_t i = 0; i < 2; i++)
         {
-            comp_[i] = Compressor::create(patchState_->sampleRate);
-            comp_[i]->setThreshold(-16);
             ef_[i] = EnvFollower::create();
         }
 
         densityQuantizer_.Init(kClockUnityRatioIndex, 0.15f, false);
+        voicingQuantizer_.Init(ECHO_VOICING_LAST, 0.15f, false);
     }
     ~Echo()
     {
-        for (size_t i = 0; i < kEchoTaps; i++)
+        for (size_t i = 0; i < 2; i++)
         {
-            DelayLine::destroy(lines_[i]);
+            EchoDelayLine::destroy(lines_[i]);
         }
         DjFilter::destroy(filter_);
+        Bypass::destroy(bypass_);
+        StereoCompressor::destroy(comp_);
+        AudioBuffer::destroy(wet_);
         for (size_t i = 0; i < 2; i++)
         {
-            Compressor::destroy(comp_[i]);
             EnvFollower::destroy(ef_[i]);
         }
     }
@@ -200,6 +250,43 @@ public:
         delete obj;
     }
 
+    /**
+     * @brief Switches to another set of taps. With the internal clock the
+     *        taps the two voicings share glide to their new times like
+     *        they do on a density change, with the external clock they
+     *        crossfade during the next block. The added taps start right at
+     *        their times.
+     */
+    void SetVoicing(EchoVoicingType type)
+    {
+        int oldTaps = voicing_->taps;
+        if (!externalClock_)
+        {
+            // The old taps are read from there during the crossfade.
+            for (int i = 0; i < oldTaps; i++)
+            {
+                tapsTimes_[i] = newTapsTimes_[i];
+            }
+        }
+        float d = externalClock_ ? kModClockRatios[clockRatiosIndex_] * patchState_->clockSamples * kEchoExternalClockMultiplier : oldDensity_;
+
+        voicing_ = &kEchoVoicings[type];
+        for (int i = 0; i < voicing_->taps; i++)
+        {
+            if (i >= oldTaps)
+            {
+                tapsRatios_[i] = voicing_->ratios[i];
+                SetTapTime(i, d * voicing_->ratios[i]);
+                tapsTimes_[i] = newTapsTimes_[i];
+            }
+            else if (externalClock_)
+            {
+                // tapsTimes_ keeps the old time, the read crossfades from it.
+                SetTapTime(i, d * voicing_->ratios[i]);
+            }
+        }
+    }
+
     void process(AudioBuffer &input, AudioBuffer &output)
     {
         size_t size = output.getSize();
@@ -208,14 +295,27 @@ public:
         FloatArray leftOut = output.getSamples(LEFT_CHANNEL);
         FloatArray rightOut = output.getSamples(RIGHT_CHANNEL);
 
+        if (!bypass_->Process(patchCtrls_->echoVol))
+        {
+            if (&input != &output)
+            {
+                output.copyFrom(input);
+            }
+
+            return;
+        }
+
         SetFilter(patchCtrls_->echoFilter);
 
-        float d = Modulate(patchCtrls_->echoDensity, patchCtrls_->echoDensityModAmount, patchState_->modValue, patchCtrls_->echoDensityCvAmount, patchCvs_->echoDensity, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        if (externalClock_)
+        const EchoVoicing* voicing = &kEchoVoicings[voicingQuantizer_.Process(patchCtrls_->echoVoicing)];
+        if (voicing != voicing_)
         {
-            SetDensity(d);
+            SetVoicing(static_cast<EchoVoicingType>(voicing - kEchoVoicings));
         }
 
+        float d = Modulate(patchCtrls_->echoDensity, patchCtrls_->echoDensityModAmount, patchState_->modValue, patchCtrls_->echoDensityCvAmount, patchCvs_->echoDensity, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
+        SetDensity(d);
+
         float r = Modulate(patchCtrls_->echoRepeats, patchCtrls_->echoRepeatsModAmount, patchState_->modValue, patchCtrls_->echoRepeatsCvAmount, patchCvs_->echoRepeats, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
         SetRepeats(r);
 
@@ -226,31 +326,42 @@ public:
 
         float x = 0;
 
+        FloatArray leftWet = wet_->getSamples(LEFT_CHANNEL);
+        FloatArray rightWet = wet_->getSamples(RIGHT_CHANNEL);
+
         for (int i = 0; i < size; i++)
         {
             // Using crossfade between two different tap times when the clock is
             // external and a filtered density param for when the clock is
             // internal (for pitch shifting effect).
-            if (externalClock_)
+            x += xi_;
+            if (!externalClock_)
             {
-                outs_[TAP_LEFT_A] = lines_[TAP_LEFT_A]->read(tapsTimes_[TAP_LEFT_A], newTapsTimes_[TAP_LEFT_A], x); // A
-                outs_[TAP_LEFT_B] = lines_[TAP_LEFT_B]->read(tapsTimes_[TAP_LEFT_B], newTapsTimes_[TAP_LEFT_B], x); // B
-                outs_[TAP_RIGHT_A] = lines_[TAP_RIGHT_A]->read(tapsTimes_[TAP_RIGHT_A], newTapsTimes_[TAP_RIGHT_A], x); // A
-                outs_[TAP_RIGHT_B] = lines_[TAP_RIGHT_B]->read(tapsTimes_[TAP_RIGHT_B], newTapsTimes_[TAP_RIGHT_B], x); // B
-
-                x += xi_;
+                for (int j = 0; j < voicing_->taps; j++)
+                {
+                    newTapsTimes_[j] += tapsIncs_[j];
+                }
             }
-            else
+
+            float fb[2];
+            float mix[2];
+            MixTaps(voicing_, false, x, fb, mix);
+
+            // The block after a voicing change crossfades from the old taps.
+            if (oldVoicing_ != voicing_)
             {
-                SetDensity(d);
-                outs_[TAP_LEFT_A] = lines_[TAP_LEFT_A]->read(newTapsTimes_[TAP_LEFT_A]); // A
-                outs_[TAP_LEFT_B] = lines_[TAP_LEFT_B]->read(newTapsTimes_[TAP_LEFT_B]); // B
-                outs_[TAP_RIGHT_A] = lines_[TAP_RIGHT_A]->read(newTapsTimes_[TAP_RIGHT_A]); // A
-                outs_[TAP_RIGHT_B] = lines_[TAP_RIGHT_B]->read(newTapsTimes_[TAP_RIGHT_B]); // B
+                float oldFb[2];
+                float oldMix[2];
+                MixTaps(oldVoicing_, true, x, oldFb, oldMix);
+                for (int c = 0; c < 2; c++)
+                {
+                    fb[c] = LinearCrossFade(oldFb[c], fb[c], x);
+                    mix[c] = LinearCrossFade(oldMix[c], mix[c], x);
+                }
             }
 
-            float leftFb = HardClip(outs_[TAP_LEFT_A] * levels_[TAP_LEFT_A] + outs_[TAP_RIGHT_A] * levels_[TAP_RIGHT_A]);
-            float rightFb = HardClip(outs_[TAP_LEFT_B] * levels_[TAP_LEFT_B] + outs_[TAP_RIGHT_B] * levels_[TAP_RIGHT_B]);
+            float leftFb = HardClip(fb[LEFT_CHANNEL]);
+            float rightFb = HardClip(fb[RIGHT_CHANNEL]);
 
             if (infinite_)
             {
@@ -264,32 +375,38 @@ public:
             float leftFilter;
             float rightFilter;
 
-            filter_->Process(lIn, rIn, leftFilter, rightFilter);
+            float g = bypass_->InputGain();
+            filter_->Process(lIn * g, rIn * g, leftFilter, rightFilter);
 
             leftFb += leftFilter;
             rightFb += rightFilter;
 
-            lines_[TAP_LEFT_A]->write(leftFb);
-            lines_[TAP_LEFT_B]->write(leftFb);
-            lines_[TAP_RIGHT_A]->write(rightFb);
-            lines_[TAP_RIGHT_B]->write(rightFb);
+            bypass_->Track(leftFb, rightFb);
+
+            lines_[LEFT_CHANNEL]->write(leftFb);
+            lines_[RIGHT_CHANNEL]->write(rightFb);
 
-            float left = Mix2(outs_[TAP_LEFT_A], outs_[TAP_LEFT_B]);
-            float right = Mix2(outs_[TAP_RIGHT_A], outs_[TAP_RIGHT_B]);
+            leftWet[i] = mix[LEFT_CHANNEL];
+            rightWet[i] = mix[RIGHT_CHANNEL];
+        }
 
-            left = comp_[LEFT_CHANNEL]->process(left) * kEchoMakeupGain;
-            right = comp_[RIGHT_CHANNEL]->process(right) * kEchoMakeupGain;
+        comp_->process(*wet_, *wet_);
 
-            leftOut[i] = CheapEqualPowerCrossFade(lIn, left, patchCtrls_->echoVol, 1.8f);
-            rightOut[i] = CheapEqualPowerCrossFade(rIn, right, patchCtrls_->echoVol, 1.8f);
+        for (size_t i = 0; i < size; i++)
+        {
+            float lIn = Clamp(leftIn[i], -3.f, 3.f);
+            float rIn = Clamp(rightIn[i], -3.f, 3.f);
+            leftOut[i] = CheapEqualPowerCrossFade(lIn, leftWet[i] * kEchoMakeupGain, patchCtrls_->echoVol, 1.8f);
+            rightOut[i] = CheapEqualPowerCrossFade(rIn, rightWet[i] * kEchoMakeupGain, patchCtrls_->echoVol, 1.8f);
         }
 
         if (externalClock_)
         {
-            for (size_t j = 0; j < kEchoTaps; j++)
+            for (int j = 0; j < voicing_->taps; j++)
             {
                 tapsTimes_[j] = newTapsTimes_[j];
             }
         }
+        oldVoicing_ = voicing_;
     }
 };
\ No newline at end of file
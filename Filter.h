@@ -1,10 +1,12 @@
 #pragma once
 
 #include "Commons.h"
-#include "StateVariableFilter.h"
+#include "Adaa.h"
+#include "PackedStateVariableFilter.h"
 #include "ChaosNoise.h"
 #include "DcBlockingFilter.h"
 #include "EnvFollower.h"
+#include "Bypass.h"
 
 enum FilterMode
 {
@@ -22,124 +24,106 @@ enum FilterPosition
     POSITION_4,
 };
 
-class Allpass
+/**
+ * @brief Stereo comb made of a chain of allpasses: two fixed ones, two
+ *        samples long, and two tuned ones, one and two periods long. Both
+ *        channels share the coefficients and run side by side, the tuned
+ *        lines are interleaved and indexed with a mask.
+ */
+class StereoCombFilter
 {
 private:
-    FloatArray line_;
-    int s_, w_;
-    float d_, c_, sr_;
-
-public:
-    Allpass(float sampleRate, int size)
-    {
-        sr_ = sampleRate;
-        s_ = size;
-        line_ = FloatArray::create(size);
-        w_ = 0;
-        d_ = 1.f;
-        c_ = 0.7f;
-    }
-    ~Allpass()
-    {
-        FloatArray::destroy(line_);
-    }
+    FloatArray lines_[2]; // Tuned allpasses, L/R interleaved
+    float fixed_[2][2][2]; // Fixed allpasses, [stage][sample][channel]
+    EnvFollower* ef_[2];
 
-    static Allpass* create(float sampleRate, int size)
-    {
-        return new Allpass(sampleRate, size);
-    }
+    float sampleRate_, reso_;
+    float delays_[2];
+    float c_;
+    float outs_[2];
 
-    static void destroy(Allpass* obj)
-    {
-        delete obj;
-    }
+    size_t w_, fw_;
+    int points_;
 
-    void SetDelay(float d)
+    inline float Fixed(size_t stage, size_t lane, float in)
     {
-        d_ = d;
-    }
+        float out = c_ * fixed_[stage][fw_][lane];
+        out += in - c_ * out;
+        fixed_[stage][fw_][lane] = out;
 
-    void SetC(float c)
-    {
-        c_ = c;
+        return out;
     }
 
-    inline float readAt(int index)
+    inline float Tuned(size_t stage, size_t lane, float in)
     {
-        int r = w_ - index;
-        if (r < 0)
+        float* line = lines_[stage].getData();
+        float d = delays_[stage];
+        size_t idx = (size_t)d;
+        float frac = d - idx;
+
+        // The current position hasn't been written yet, the shortest delay
+        // is a couple of samples so the sample after x0 is always valid.
+        size_t r = w_ - idx;
+        float x0 = line[(r & (kFilterCombLineSize - 1)) * 2 + lane];
+        float x1 = line[((r - 1) & (kFilterCombLineSize - 1)) * 2 + lane];
+
+        float y;
+        if (4 == points_)
         {
-            r += s_;
+            float xm1 = line[((r + 1) & (kFilterCombLineSize - 1)) * 2 + lane];
+            float x2 = line[((r - 2) & (kFilterCombLineSize - 1)) * 2 + lane];
+            y = HermiteInterpolate(xm1, x0, x1, x2, frac);
+        }
+        else
+        {
+            y = x0 + (x1 - x0) * frac;
         }
 
-        return line_.getElement(r);
-    }
-
-    float Process(float in)
-    {
-        size_t idx = (size_t)d_;
-        float y0 = readAt(idx);
-        float y1 = readAt(idx + 1);
-        float frac = d_ - idx;
-
-        float out = Interpolator::linear(y0, y1, frac) + (-c_ * in);
-
-        line_.setElement(w_, in + (c_ * out));
-
-        w_ = (w_ + 1) % s_;
-
-        return out;
-    }
-
-    float ProcessFixed(float in)
-    {
-        float out = 0;
-        float delayedSample = line_.getElement(w_);
-
-        out += c_ * delayedSample;
-        out += in - c_ * out;
-
-        line_.setElement(w_, out);
-        w_ = (w_ + 1) % s_;
+        float out = y - c_ * in;
+        line[(w_ & (kFilterCombLineSize - 1)) * 2 + lane] = in + c_ * out;
 
         return out;
     }
-};
-
-class CombFilter
-{
-private:
-    Allpass* poles_[4];
-    EnvFollower* ef_;
-    float sampleRate_, reso_, out_;
 
 public:
-    CombFilter(float sampleRate)
+    StereoCombFilter(float sampleRate)
     {
         sampleRate_ = sampleRate;
-        poles_[0] = Allpass::create(sampleRate, 2); // Fixed
-        poles_[1] = Allpass::create(sampleRate, 9600); // Variable
-        poles_[2] = Allpass::create(sampleRate, 2); // Fixed
-        poles_[3] = Allpass::create(sampleRate, 9600); // Variable
-        ef_ = EnvFollower::create();
+        for (size_t i = 0; i < 2; i++)
+        {
+            lines_[i] = FloatArray::create(kFilterCombLineSize * 2);
+            lines_[i].clear();
+            ef_[i] = EnvFollower::create();
+            outs_[i] = 0;
+            delays_[i] = 1.f;
+        }
+        for (size_t i = 0; i < 2; i++)
+        {
+            for (size_t j = 0; j < 2; j++)
+            {
+                fixed_[i][j][LEFT_CHANNEL] = fixed_[i][j][RIGHT_CHANNEL] = 0;
+            }
+        }
         reso_ = 0;
-        out_ = 0;
+        c_ = 0.7f;
+        w_ = fw_ = 0;
+        points_ = 4;
     }
-    ~CombFilter()
+    ~StereoCombFilter()
     {
-        for (size_t i = 0; i < 4; i++)
+        for (size_t i = 0; i < 2; i++)
         {
-            Allpass::destroy(poles_[i]);
+            FloatArray::destroy(lines_[i]);
+            EnvFollower::destroy(ef_[i]);
         }
-        EnvFollower::destroy(ef_);
     }
 
-    static CombFilter* create(float sampleRate)
+    static StereoCombFilter* create(float sampleRate)
     {
-        return new CombFilter(sampleRate);
+        return new StereoCombFilter(sampleRate);
     }
 
-    static void destroy(CombFilter* obj)
+    static void destroy(StereoCombFilter* obj)
     {
         delete obj;
     }
@@ -147,10 +131,8 @@ public:
     void SetFrequency(float freq)
     {
         float d = sampleRate_ / freq;
-        //poles_[0]->SetDelay(d);
-        poles_[1]->SetDelay(d);
-        //poles_[2]->SetDelay(d);
-        poles_[3]->SetDelay(d + d);
+        delays_[0] = Clamp(d, 2.f, kFilterCombLineSize / 2 - 2);
+        delays_[1] = Clamp(d + d, 2.f, kFilterCombLineSize - 3);
     }
 
     void SetResonance(float reso)
@@ -158,19 +140,43 @@ public:
         reso_ = reso;
     }
 
-    float Process(float in)
+    /**
+     * @param points 4 for Hermite interpolation of the tuned lines, which
+     *        keeps the high notes in tune, 2 for linear
+     */
+    void SetInterpolation(int points)
     {
-        float i = in + reso_ * out_;
-        i *= 1.f - ef_->process(i);
-
-        float o = poles_[0]->ProcessFixed(i);
-        o = poles_[1]->Process(o);
-        o = poles_[2]->ProcessFixed(o);
-        o = poles_[3]->Process(o);
+        points_ = points;
+    }
 
-        out_ = o;
+    inline void Process(const float* input, float* output)
+    {
+        float x[2];
+        for (size_t j = 0; j < 2; j++)
+        {
+            x[j] = input[j] + reso_ * outs_[j];
+            x[j] *= 1.f - ef_[j]->process(x[j]);
+        }
+        for (size_t j = 0; j < 2; j++)
+        {
+            x[j] = Fixed(0, j, x[j]);
+        }
+        for (size_t j = 0; j < 2; j++)
+        {
+            x[j] = Tuned(0, j, x[j]);
+        }
+        for (size_t j = 0; j < 2; j++)
+        {
+            x[j] = Fixed(1, j, x[j]);
+        }
+        for (size_t j = 0; j < 2; j++)
+        {
+            x[j] = Tuned(1, j, x[j]);
+            outs_[j] = output[j] = x[j];
+        }
 
-        return out_;
+        w_++;
+        fw_ ^= 1;
     }
 };
 
@@ -180,93 +186,105 @@ private:
     PatchCtrls* patchCtrls_;
     PatchCvs* patchCvs_;
     PatchState* patchState_;
-    StateVariableFilter* filters_[2];
-    CombFilter* combs_[2];
-    ChaosNoise noise_;
+    PackedStateVariableFilter<2>* filter_;
+    StereoCombFilter* comb_;
+    ChaosNoiseBank<2> noise_;
+    AudioBuffer* noiseBuffer_;
+    Bypass* bypass_;
     FilterMode mode_, lastMode_;
     DcBlockingFilter* dc_[2];
     EnvFollower* ef_[2];
+    Adaa2<SoftClipShape> driveClip_;
+    Adaa1<HardClipShape> combClip_;
+    float dry1_[2]; // Previous dry sample, the drive clipper delays by one
 
     float drive_;
     float freq_;
     float reso_, resoValue_;
+    float resoParam_, cutoffParam_, modeParam_;
+    float morph_;
     float amp_;
     float filterGain_;
     float dryWet_;
     float noiseLevel_;
     float feedback_;
 
+    /**
+     * @brief Below the comb filter the knob morphs continuously from low
+     *        pass to band pass to high pass, with a plateau on each response.
+     */
     void SetMode(float value)
     {
-        FilterMode mode;
+        if (value >= kFilterMorphCombStart)
+        {
+            mode_ = FilterMode::CF;
 
-        if (value >= 0.75f)
+            return;
+        }
+
+        if (value < kFilterMorphLpEnd)
         {
-            mode = FilterMode::CF;
+            morph_ = 0.f;
         }
-        else if (value >= 0.5f)
+        else if (value < kFilterMorphBpStart)
         {
-            mode = FilterMode::HP;
+            morph_ = Map(value, kFilterMorphLpEnd, kFilterMorphBpStart, 0.f, 1.f);
         }
-        else if (value >= 0.25f)
+        else if (value < kFilterMorphBpEnd)
         {
-            mode = FilterMode::BP;
+            morph_ = 1.f;
+        }
+        else if (value < kFilterMorphHpStart)
+        {
+            morph_ = Map(value, kFilterMorphBpEnd, kFilterMorphHpStart, 1.f, 2.f);
         }
         else
         {
-            mode = FilterMode::LP;
+            morph_ = 2.f;
         }
 
-        if (mode == mode_)
+        // Closest response, for the UI.
+        if (morph_ < 0.5f)
         {
-            return;
+            mode_ = FilterMode::LP;
+        }
+        else if (morph_ < 1.5f)
+        {
+            mode_ = FilterMode::BP;
+        }
+        else
+        {
+            mode_ = FilterMode::HP;
         }
-
-        mode_ = mode;
     }
 
     void SetFreq(float value)
     {
-        filterGain_ = kFilterLpGainMin;
-
         float cutoff = Clamp(MapLog(value, 0.f, 1.f, 10.f, 22000.f), 10.f, 22000.f);
 
-        switch (mode_)
+        if (FilterMode::CF != mode_)
+        {
+            // The modulation updates once per block, glide over it to avoid
+            // zipper noise.
+            filter_->SetMorph(cutoff, reso_, morph_, patchState_->blockSize);
+
+            // Shut the filter off when the frequency is really low or high.
+            float lpGain = MapExpo(resoValue_, 0.f, 1.f, kFilterLpGainMax, kFilterLpGainMin);
+            lpGain = cutoff <= 15.f ? Map(cutoff, 10.f, 15.f, 0.f, lpGain) : lpGain;
+            float bpGain = MapExpo(resoValue_, 0.f, 1.f, kFilterBpGainMin, kFilterBpGainMax);
+            float hpGain = MapExpo(resoValue_, 0.f, 1.f, kFilterHpGainMax, kFilterHpGainMin);
+            hpGain = cutoff >= 20000.f ? Map(cutoff, 15000, 20000, hpGain, 0.f) : hpGain;
+
+            // Same weights as the responses.
+            filterGain_ = Max(1.f - morph_, 0.f) * lpGain + (1.f - fabsf(morph_ - 1.f)) * bpGain + Max(morph_ - 1.f, 0.f) * hpGain;
+        }
+        else
         {
-        case FilterMode::LP:
-            {
-                filters_[LEFT_CHANNEL]->setLowPass(cutoff, reso_);
-                filters_[RIGHT_CHANNEL]->setLowPass(cutoff, reso_);
-                // Shut the filter off when the frequency is really low.
-                float g = MapExpo(resoValue_, 0.f, 1.f, kFilterLpGainMax, kFilterLpGainMin);
-                filterGain_ = cutoff <= 15.f ? Map(cutoff, 10.f, 15.f, 0.f, g) : g;
-                break;
-            }
-        case FilterMode::BP:
-            {
-                filters_[LEFT_CHANNEL]->setBandPass(cutoff, reso_);
-                filters_[RIGHT_CHANNEL]->setBandPass(cutoff, reso_);
-                filterGain_ = MapExpo(resoValue_, 0.f, 1.f, kFilterBpGainMin, kFilterBpGainMax);
-            }
-            break;
-        case FilterMode::HP:
-            {
-                filters_[LEFT_CHANNEL]->setHighPass(cutoff, reso_);
-                filters_[RIGHT_CHANNEL]->setHighPass(cutoff, reso_);
-                // Shut the filter off when the frequency is really high.
-                float g = MapExpo(resoValue_, 0.f, 1.f, kFilterHpGainMax, kFilterHpGainMin);
-                filterGain_ = cutoff >= 20000.f ? Map(cutoff, 15000, 20000, g, 0.f) : g;
-                break;
-            }
-        case FilterMode::CF:
             float f = Clamp(Map(value, 0.f, 1.f, 100.f, 15000.f), 100.f, 15000.f);
             float r = Clamp(VariableCrossFade(0.f, 0.8f, resoValue_, 0.9f), 0.f, 0.8f);
-            combs_[LEFT_CHANNEL]->SetFrequency(f);
-            combs_[LEFT_CHANNEL]->SetResonance(r);
-            combs_[RIGHT_CHANNEL]->SetFrequency(f);
-            combs_[RIGHT_CHANNEL]->SetResonance(r);
+            comb_->SetFrequency(f);
+            comb_->SetResonance(r);
             filterGain_ = MapExpo(resoValue_, 0.f, 1.f, kFilterCombGainMax, kFilterCombGainMin);
-            break;
         }
         noise_.SetFreq(cutoff);
     }
@@ -294,25 +312,33 @@ public:
 
         noise_.Init(patchState_->sampleRate);
         noise_.SetChaos(kFilterChaosNoise);
+        noiseBuffer_ = AudioBuffer::create(2, patchState_->blockSize);
+        bypass_ = Bypass::create(patchState_->blockSize, kFilterCombLineSize);
+
+        filter_ = PackedStateVariableFilter<2>::create(patchState_->sampleRate);
+        comb_ = StereoCombFilter::create(patchState_->sampleRate);
 
         for (size_t i = 0; i < 2; i++)
         {
-            filters_[i] = StateVariableFilter::create(patchState_->sampleRate);
-            combs_[i] = CombFilter::create(patchState_->sampleRate);
             dc_[i] = DcBlockingFilter::create();
             ef_[i] = EnvFollower::create();
+            dry1_[i] = 0;
         }
 
         mode_ = lastMode_ = FilterMode::LP;
+        resoParam_ = cutoffParam_ = modeParam_ = -1.f;
+        morph_ = 0.f;
         freq_ = 22000.f;
         amp_ = Db2A(120);
     }
     ~Filter()
     {
+        PackedStateVariableFilter<2>::destroy(filter_);
+        StereoCombFilter::destroy(comb_);
+        AudioBuffer::destroy(noiseBuffer_);
+        Bypass::destroy(bypass_);
         for (size_t i = 0; i < 2; i++)
         {
-            StateVariableFilter::destroy(filters_[i]);
-            CombFilter::destroy(combs_[i]);
             DcBlockingFilter::destroy(dc_[i]);
             EnvFollower::destroy(ef_[i]);
         }
@@ -348,46 +374,83 @@ public:
             patchState_->filterModeFlag = false;
         }
 
-        float r = Modulate(patchCtrls_->filterResonance, patchCtrls_->filterResonanceModAmount, patchState_->modValue, patchCtrls_->filterResonanceCvAmount, patchCvs_->filterResonance, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        SetReso(r);
+        if (!bypass_->Process(patchCtrls_->filterVol))
+        {
+            if (&input != &output)
+            {
+                output.copyFrom(input);
+            }
+
+            return;
+        }
 
+        float r = Modulate(patchCtrls_->filterResonance, patchCtrls_->filterResonanceModAmount, patchState_->modValue, patchCtrls_->filterResonanceCvAmount, patchCvs_->filterResonance, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
         float c = Modulate(patchCtrls_->filterCutoff, patchCtrls_->filterCutoffModAmount, patchState_->modValue, patchCtrls_->filterCutoffCvAmount, patchCvs_->filterCutoff, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        SetFreq(c);
+
+        // Only update the coefficients when something has changed.
+        if (r != resoParam_ || c != cutoffParam_ || patchCtrls_->filterMode != modeParam_)
+        {
+            modeParam_ = patchCtrls_->filterMode;
+            resoParam_ = r;
+            cutoffParam_ = c;
+            SetReso(r);
+            SetFreq(c);
+        }
 
         if (StartupPhase::STARTUP_DONE != patchState_->startupPhase)
         {
             return;
         }
 
+        comb_->SetInterpolation(kQualityCombInterpolation[patchState_->qualityLevel]);
+
+        // Decorrelated noise for each channel.
+        float* noise[2] = {noiseBuffer_->getSamples(LEFT_CHANNEL).getData(), noiseBuffer_->getSamples(RIGHT_CHANNEL).getData()};
+        noise_.Process(noise, size);
+
         for (size_t i = 0; i < size; i++)
         {
-            float n = noise_.Process() * noiseLevel_;
+            float g = bypass_->InputGain();
+            float ln = noise[LEFT_CHANNEL][i] * noiseLevel_ * g;
+            float rn = noise[RIGHT_CHANNEL][i] * noiseLevel_ * g;
 
             float lIn = Clamp(leftIn[i], -3.f, 3.f);
             float rIn = Clamp(rightIn[i], -3.f, 3.f);
+            float lFeed = lIn * g;
+            float rFeed = rIn * g;
 
-            float ls = SoftClip(lIn * amp_ + n);
-            float rs = SoftClip(rIn * amp_ + n);
+            float ls = driveClip_.Process(LEFT_CHANNEL, lFeed * amp_ + ln);
+            float rs = driveClip_.Process(RIGHT_CHANNEL, rFeed * amp_ + rn);
 
-            float lf = LinearCrossFade(lIn + n, ls, drive_);
-            float rf = LinearCrossFade(rIn + n, rs, drive_);
+            float lf = LinearCrossFade(dry1_[LEFT_CHANNEL], ls, drive_);
+            float rf = LinearCrossFade(dry1_[RIGHT_CHANNEL], rs, drive_);
+            dry1_[LEFT_CHANNEL] = lFeed + ln;
+            dry1_[RIGHT_CHANNEL] = rFeed + rn;
 
             float lo, ro;
             if (FilterMode::CF == mode_)
             {
-                lo = HardClip(combs_[LEFT_CHANNEL]->Process(lf) * filterGain_);
-                ro = HardClip(combs_[RIGHT_CHANNEL]->Process(rf) * filterGain_);
+                float in[2] = {lf, rf};
+                float out[2];
+                comb_->Process(in, out);
+                lo = combClip_.Process(LEFT_CHANNEL, out[LEFT_CHANNEL] * filterGain_);
+                ro = combClip_.Process(RIGHT_CHANNEL, out[RIGHT_CHANNEL] * filterGain_);
                 lo = dc_[LEFT_CHANNEL]->process(lo);
                 ro = dc_[RIGHT_CHANNEL]->process(ro);
             }
             else
             {
-                lo = filters_[LEFT_CHANNEL]->process(lf) * filterGain_;
-                ro = filters_[RIGHT_CHANNEL]->process(rf) * filterGain_;
+                float in[2] = {lf, rf};
+                float out[2];
+                filter_->Process(in, out);
+                lo = out[LEFT_CHANNEL] * filterGain_;
+                ro = out[RIGHT_CHANNEL] * filterGain_;
                 lo *= 1.f - ef_[LEFT_CHANNEL]->process(lo);
                 ro *= 1.f - ef_[RIGHT_CHANNEL]->process(ro);
             }
 
+            bypass_->Track(lo, ro);
+
             leftOut[i] = CheapEqualPowerCrossFade(lIn, lo * kFilterMakeupGain, patchCtrls_->filterVol);
             rightOut[i] = CheapEqualPowerCrossFade(rIn, ro * kFilterMakeupGain, patchCtrls_->filterVol);
         }
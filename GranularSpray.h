@@ -178,6 +178,14 @@ public:
         float sprayAmount = patchCtrls_->granularSpray;
         if (sprayAmount <= 0.001f) return; // No grains if spray is zero
         
+        // Respect the number of grains allowed by the current quality level,
+        // the ones already playing are left to finish
+        int activeGrains = 0;
+        for (int i = 0; i < MAX_SPRAY_GRAINS; i++) {
+            if (grains_[i].active) activeGrains++;
+        }
+        if (activeGrains >= kQualitySprayGrains[patchState_->qualityLevel]) return;
+        
         // Find inactive grain
         for (int i = 0; i < MAX_SPRAY_GRAINS; i++) {
             int grainIndex = (nextGrainIndex_ + i) % MAX_SPRAY_GRAINS;
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "Commons.h"
+#include <stdint.h>
+
+/**
+ * Polyphase IIR halfband coefficients, from
+ * https://www.musicdsp.org/en/latest/Filters/39-polyphase-filters.html
+ * Each branch is a chain of first order allpasses running at the low rate.
+ */
+// Order 8, ~106dB rejection, 0.05 transition band.
+static const float kHalfBandSteepA[] = {0.03583278843106211f, 0.2720401433964576f, 0.5720571972357003f, 0.827124761997324f};
+static const float kHalfBandSteepB[] = {0.1340901419430669f, 0.4243248712718685f, 0.7062921421386394f, 0.9415030941737551f};
+// Order 4, ~70dB rejection, 0.1 transition band. Enough for the stage
+// running at the highest rate, where the band to keep is narrow.
+static const float kHalfBandSoftA[] = {0.07986642623635751f, 0.5453536510711322f};
+static const float kHalfBandSoftB[] = {0.28382934487410993f, 0.8344118914807379f};
+
+/**
+ * @brief Stereo 2x decimator/interpolator made of two allpass branches.
+ *        Both channels are processed in the same loop.
+ *
+ * @tparam N Number of allpasses per branch
+ */
+template <size_t N>
+class StereoHalfBand
+{
+private:
+    const float* a_;
+    const float* b_;
+
+    float xa_[N][2], ya_[N][2];
+    float xb_[N][2], yb_[N][2];
+
+    inline float Branch(const float* coeffs, float (*x1)[2], float (*y1)[2], size_t lane, float x)
+    {
+        for (size_t k = 0; k < N; k++)
+        {
+            float y = coeffs[k] * (x - y1[k][lane]) + x1[k][lane];
+            x1[k][lane] = x;
+            y1[k][lane] = y;
+            x = y;
+        }
+
+        return x;
+    }
+
+public:
+    StereoHalfBand(const float* a, const float* b)
+    {
+        a_ = a;
+        b_ = b;
+        Reset();
+    }
+    ~StereoHalfBand() {}
+
+    static StereoHalfBand* create(const float* a, const float* b)
+    {
+        return new StereoHalfBand(a, b);
+    }
+
+    static void destroy(StereoHalfBand* obj)
+    {
+        delete obj;
+    }
+
+    void Reset()
+    {
+        for (size_t k = 0; k < N; k++)
+        {
+            for (size_t c = 0; c < 2; c++)
+            {
+                xa_[k][c] = ya_[k][c] = 0;
+                xb_[k][c] = yb_[k][c] = 0;
+            }
+        }
+    }
+
+    /**
+     * @brief Filters and halves the sample rate, input must hold
+     *        size * 2 samples per channel.
+     */
+    inline void Decimate(const float* const* input, float* const* output, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            for (size_t c = 0; c < 2; c++)
+            {
+                float a = Branch(a_, xa_, ya_, c, input[c][i * 2 + 1]);
+                float b = Branch(b_, xb_, yb_, c, input[c][i * 2]);
+                output[c][i] = (a + b) * 0.5f;
+            }
+        }
+    }
+
+    /**
+     * @brief Doubles the sample rate and filters, output must hold
+     *        size * 2 samples per channel.
+     */
+    inline void Interpolate(const float* const* input, float* const* output, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            for (size_t c = 0; c < 2; c++)
+            {
+                float x = input[c][i];
+                output[c][i * 2] = Branch(a_, xa_, ya_, c, x);
+                output[c][i * 2 + 1] = Branch(b_, xb_, yb_, c, x);
+            }
+        }
+    }
+};
+
+/**
+ * @brief Brings a stereo signal rendered at 2x or 4x the sample rate back to
+ *        the base rate. The 4x signal goes through a cheaper stage first, the
+ *        last stage is shared, so switching between 2x and 4x keeps its
+ *        state. A stage that wasn't running in the previous block is reset
+ *        before it's used again.
+ */
+class StereoDecimator
+{
+private:
+    StereoHalfBand<2>* first_;
+    StereoHalfBand<4>* last_;
+    AudioBuffer* buffer_;
+
+    int factor_; // Factor of the previous block
+
+public:
+    StereoDecimator(size_t blockSize)
+    {
+        first_ = StereoHalfBand<2>::create(kHalfBandSoftA, kHalfBandSoftB);
+        last_ = StereoHalfBand<4>::create(kHalfBandSteepA, kHalfBandSteepB);
+        buffer_ = AudioBuffer::create(2, blockSize * 2);
+        factor_ = 1;
+    }
+    ~StereoDecimator()
+    {
+        StereoHalfBand<2>::destroy(first_);
+        StereoHalfBand<4>::destroy(last_);
+        AudioBuffer::destroy(buffer_);
+    }
+
+    static StereoDecimator* create(size_t blockSize)
+    {
+        return new StereoDecimator(blockSize);
+    }
+
+    static void destroy(StereoDecimator* obj)
+    {
+        delete obj;
+    }
+
+    void Reset()
+    {
+        first_->Reset();
+        last_->Reset();
+    }
+
+    /**
+     * @brief Takes the state of another decimator, so that a block can be
+     *        processed twice (i.e. at two factors to crossfade them).
+     */
+    void CopyFrom(const StereoDecimator& other)
+    {
+        *first_ = *other.first_;
+        *last_ = *other.last_;
+        factor_ = other.factor_;
+    }
+
+    /**
+     * @param input Holds output's size * factor samples per channel
+     * @param factor 1, 2 or 4
+     */
+    void Process(AudioBuffer &input, AudioBuffer &output, int factor)
+    {
+        size_t size = output.getSize();
+
+        if (factor != factor_)
+        {
+            if (4 == factor)
+            {
+                first_->Reset();
+            }
+            if (1 == factor_)
+            {
+                last_->Reset();
+            }
+            factor_ = factor;
+        }
+
+        float* in[2] = {input.getSamples(LEFT_CHANNEL).getData(), input.getSamples(RIGHT_CHANNEL).getData()};
+        float* out[2] = {output.getSamples(LEFT_CHANNEL).getData(), output.getSamples(RIGHT_CHANNEL).getData()};
+
+        if (4 == factor)
+        {
+            float* half[2] = {buffer_->getSamples(LEFT_CHANNEL).getData(), buffer_->getSamples(RIGHT_CHANNEL).getData()};
+            first_->Decimate(in, half, size * 2);
+            last_->Decimate(half, out, size);
+        }
+        else if (2 == factor)
+        {
+            last_->Decimate(in, out, size);
+        }
+        else if (&input != &output)
+        {
+            output.getSamples(LEFT_CHANNEL).copyFrom(input.getSamples(LEFT_CHANNEL).subArray(0, size));
+            output.getSamples(RIGHT_CHANNEL).copyFrom(input.getSamples(RIGHT_CHANNEL).subArray(0, size));
+        }
+    }
+};
+
+/**
+ * @brief Brings a stereo signal at the base rate to 2x or 4x the sample
+ *        rate. Mirrors StereoDecimator: the steep stage runs first, at the
+ *        lowest rate, and is shared by both factors. A stage that wasn't
+ *        running in the previous block is reset before it's used again.
+ */
+class StereoInterpolator
+{
+private:
+    StereoHalfBand<4>* first_;
+    StereoHalfBand<2>* last_;
+    AudioBuffer* buffer_;
+
+    int factor_; // Factor of the previous block
+
+public:
+    StereoInterpolator(size_t blockSize)
+    {
+        first_ = StereoHalfBand<4>::create(kHalfBandSteepA, kHalfBandSteepB);
+        last_ = StereoHalfBand<2>::create(kHalfBandSoftA, kHalfBandSoftB);
+        buffer_ = AudioBuffer::create(2, blockSize * 2);
+        factor_ = 1;
+    }
+    ~StereoInterpolator()
+    {
+        StereoHalfBand<4>::destroy(first_);
+        StereoHalfBand<2>::destroy(last_);
+        AudioBuffer::destroy(buffer_);
+    }
+
+    static StereoInterpolator* create(size_t blockSize)
+    {
+        return new StereoInterpolator(blockSize);
+    }
+
+    static void destroy(StereoInterpolator* obj)
+    {
+        delete obj;
+    }
+
+    void Reset()
+    {
+        first_->Reset();
+        last_->Reset();
+    }
+
+    /**
+     * @brief Takes the state of another interpolator, so that a block can be
+     *        processed twice (i.e. at two factors to crossfade them).
+     */
+    void CopyFrom(const StereoInterpolator& other)
+    {
+        *first_ = *other.first_;
+        *last_ = *other.last_;
+        factor_ = other.factor_;
+    }
+
+    /**
+     * @param output Holds input's size * factor samples per channel
+     * @param factor 1, 2 or 4
+     */
+    void Process(AudioBuffer &input, AudioBuffer &output, int factor)
+    {
+        size_t size = input.getSize();
+
+        if (factor != factor_)
+        {
+            if (4 == factor)
+            {
+                last_->Reset();
+            }
+            if (1 == factor_)
+            {
+                first_->Reset();
+            }
+            factor_ = factor;
+        }
+
+        float* in[2] = {input.getSamples(LEFT_CHANNEL).getData(), input.getSamples(RIGHT_CHANNEL).getData()};
+        float* out[2] = {output.getSamples(LEFT_CHANNEL).getData(), output.getSamples(RIGHT_CHANNEL).getData()};
+
+        if (4 == factor)
+        {
+            float* twice[2] = {buffer_->getSamples(LEFT_CHANNEL).getData(), buffer_->getSamples(RIGHT_CHANNEL).getData()};
+            first_->Interpolate(in, twice, size);
+            last_->Interpolate(twice, out, size * 2);
+        }
+        else if (2 == factor)
+        {
+            first_->Interpolate(in, out, size);
+        }
+        else
+        {
+            output.getSamples(LEFT_CHANNEL).subArray(0, size).copyFrom(input.getSamples(LEFT_CHANNEL));
+            output.getSamples(RIGHT_CHANNEL).subArray(0, size).copyFrom(input.getSamples(RIGHT_CHANNEL));
+        }
+    }
+};
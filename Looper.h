@@ -19,6 +19,7 @@ private:
     PatchCvs* patchCvs_;
     PatchState* patchState_;
     LooperBuffer* buffer_;
+    WaveTableBuffer* wtBuffer_;
     DjFilter* filter_;
     Limiter* limiter_;
     EnvFollower* ef_[2];
@@ -207,6 +208,9 @@ private:
 
         boc_ = false;
 
+        uint32_t writeStart = wPhase_;
+        uint32_t writeCount = 0;
+
         for (size_t i = 0; i < size; i++)
         {
             if (buffer_->IsRecording())
@@ -221,6 +225,7 @@ private:
                 right *= 1.f - ef_[RIGHT_CHANNEL]->process(right);
 
                 buffer_->Write(wPhase_, left, right);
+                writeCount++;
 
                 wPhase_++;
                 if (wPhase_ >= kLooperChannelBufferLength)
@@ -343,6 +348,11 @@ private:
                 bufferPhase_ = 0;
             }
         }
+
+        if (writeCount > 0)
+        {
+            wtBuffer_->Refresh(writeStart, writeCount);
+        }
     }
 
 public:
@@ -353,6 +363,7 @@ public:
         patchState_ = patchState;
 
         buffer_ = LooperBuffer::create();
+        wtBuffer_ = WaveTableBuffer::create(buffer_->GetBuffer());
         filter_ = DjFilter::create(patchState_->sampleRate);
         sosOut_ = AudioBuffer::create(2, patchState_->blockSize);
         limiter_ = Limiter::create();
@@ -391,6 +402,7 @@ public:
     }
     ~Looper()
     {
+        WaveTableBuffer::destroy(wtBuffer_);
         LooperBuffer::destroy(buffer_);
         DjFilter::destroy(filter_);
         AudioBuffer::destroy(sosOut_);
@@ -417,6 +429,11 @@ public:
         return buffer_->GetBuffer();
     }
     
+    WaveTableBuffer* GetWaveTableBuffer()
+    {
+        return wtBuffer_;
+    }
+
     float GetNormalizedPosition() {
         return (start_ + phase_) / (float)kLooperChannelBufferLength;
     }
@@ -482,10 +499,15 @@ public:
         else if (cleared_)
         {
             output.clear();
+            uint32_t position = buffer_->GetClearPosition();
             if (buffer_->Clear())
             {
                 cleared_ = false;
             }
+            else
+            {
+                wtBuffer_->Refresh(position, kLooperClearBlockSize);
+            }
         }
 
         WriteRead(input, output);
@@ -163,6 +163,14 @@ public:
         return &buffer_;
     }
 
+    /**
+     * @brief Position (per channel) of the next block that will be cleared.
+     */
+    inline uint32_t GetClearPosition()
+    {
+        return (clearBlock_ - buffer_.getData()) % kLooperChannelBufferLength;
+    }
+
     inline bool Clear()
     {
         if (clearBlock_ == buffer_.getData() + kLooperTotalBufferLength)
@@ -7,6 +7,7 @@
 #include "StereoWaveTableOscillator.h"
 #include "Ambience.h"
 #include "Filter.h"
+#include "Drive.h"
 #include "Resonator.h"
 #include "Echo.h"
 #include "Looper.h"
@@ -31,6 +32,7 @@ private:
     StereoWaveTableOscillator* wt_;
     WaveTableBuffer* wtBuffer_;
     Filter* filter_;
+    Drive* drive_;
     Resonator* resonator_;
     Echo* echo_;
     Ambience* ambience_;
@@ -60,13 +62,14 @@ public:
         patchState_ = patchState;
 
         looper_ = Looper::create(patchCtrls_, patchCvs_, patchState_);
-        wtBuffer_ = WaveTableBuffer::create(looper_->GetBuffer());
+        wtBuffer_ = looper_->GetWaveTableBuffer();
 
         sine_ = StereoSineOscillator::create(patchCtrls_, patchCvs_, patchState_);
         saw_ = StereoSuperSaw::create(patchCtrls_, patchCvs_, patchState_);
         wt_ = StereoWaveTableOscillator::create(patchCtrls_, patchCvs_, patchState_, wtBuffer_);
 
         filter_ = Filter::create(patchCtrls_, patchCvs_, patchState_);
+        drive_ = Drive::create(patchCtrls_, patchState_);
         resonator_ = Resonator::create(patchCtrls_, patchCvs_, patchState_);
         echo_ = Echo::create(patchCtrls_, patchCvs_, patchState_);
         ambience_ = Ambience::create(patchCtrls_, patchCvs_, patchState_);
@@ -97,12 +100,12 @@ public:
         AudioBuffer::destroy(resample_);
         AudioBuffer::destroy(osc1Out_);
         AudioBuffer::destroy(osc2Out_);
-        WaveTableBuffer::destroy(wtBuffer_);
         Looper::destroy(looper_);
         StereoSineOscillator::destroy(sine_);
         StereoSuperSaw::destroy(saw_);
         StereoWaveTableOscillator::destroy(wt_);
         Filter::destroy(filter_);
+        Drive::destroy(drive_);
         Resonator::destroy(resonator_);
         Echo::destroy(echo_);
         Ambience::destroy(ambience_);
@@ -219,35 +222,9 @@ public:
             filter_->process(buffer, buffer);
         }
         
-        // Apply independent distortion stage before echo (regardless of filter position)
-        if (patchCtrls_->filterDrive > 0.001f)
-        {
-            size_t size = buffer.getSize();
-            FloatArray leftSamples = buffer.getSamples(LEFT_CHANNEL);
-            FloatArray rightSamples = buffer.getSamples(RIGHT_CHANNEL);
-            
-            // Use filter's drive scaling approach but slightly reduced: 0-100% fader = 0-0.5% drive
-            float mappedDrive = patchCtrls_->filterDrive * 0.005f;
-            
-            // Use proper amp gain like the filter (but reasonable level)
-            float ampGain = 600.f; // Good amp-style distortion level
-            
-            for (size_t i = 0; i < size; i++)
-            {
-                float lIn = Clamp(leftSamples[i], -3.f, 3.f);
-                float rIn = Clamp(rightSamples[i], -3.f, 3.f);
-                
-                // Apply massive gain and soft clip (like filter does)
-                float lDriven = SoftClip(lIn * ampGain);
-                float rDriven = SoftClip(rIn * ampGain);
-                
-                // Crossfade between clean and heavily driven signal (filter's approach)
-                // Small drive amount controls how much of the saturated signal we get
-                leftSamples[i] = LinearCrossFade(lIn, lDriven, mappedDrive);
-                rightSamples[i] = LinearCrossFade(rIn, rDriven, mappedDrive);
-            }
-        }
-        
+        // Independent distortion stage before echo (regardless of filter position).
+        drive_->process(buffer, buffer);
+
         echo_->process(buffer, buffer);
         if (FilterPosition::POSITION_3 == filterPosition_)
         {
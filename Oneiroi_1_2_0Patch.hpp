@@ -4,12 +4,14 @@
 #include "Commons.h"
 #include "Ui.h"
 #include "Clock.h"
+#include "QualityGovernor.h"
 
 class Oneiroi_1_2_0Patch : public Patch {
 private:
     Ui* ui_;
     Oneiroi* oneiroi_;
     Clock* clock_;
+    QualityGovernor* governor_;
 
     PatchCtrls patchCtrls;
     PatchCvs patchCvs;
@@ -21,6 +23,7 @@ public:
         patchState.sampleRate = getSampleRate();
         patchState.blockRate = getBlockRate();
         patchState.blockSize = getBlockSize();
+        governor_ = QualityGovernor::create(&patchState);
         ui_ = Ui::create(&patchCtrls, &patchCvs, &patchState);
         oneiroi_ = Oneiroi::create(&patchCtrls, &patchCvs, &patchState);
         clock_ = Clock::create(&patchCtrls, &patchState);
@@ -30,6 +33,7 @@ public:
         Oneiroi::destroy(oneiroi_);
         Ui::destroy(ui_);
         Clock::destroy(clock_);
+        QualityGovernor::destroy(governor_);
     }
 
     void buttonChanged(PatchButtonId bid, uint16_t value, uint16_t samples) override
@@ -47,6 +51,8 @@ public:
         clock_->Process();
         ui_->Poll();
         oneiroi_->Process(buffer);
+
+        governor_->Process(getElapsedBlockTime());
     }
 };
 
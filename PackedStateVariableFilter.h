@@ -0,0 +1,249 @@
+#pragma once
+
+#include "Commons.h"
+#include "TanLut.h"
+#include <stdint.h>
+#include <cmath>
+
+/**
+ * @brief N state variable filters sharing the same coefficients, with their
+ *        state packed together so that the lanes are processed side by side
+ *        in the same loop. Same topology as the StateVariableFilter in the
+ *        OWL library (Andrew Simper's trapezoidal SVF), so the responses
+ *        match.
+ *        The topology stays stable when the coefficients change at every
+ *        sample, so the cutoff can be ramped across a block or driven by a
+ *        per-sample buffer.
+ *
+ * @tparam N Number of lanes, i.e. 2 for stereo
+ */
+template <size_t N>
+class PackedStateVariableFilter
+{
+private:
+    float sampleRate_;
+    float freq_, q_;
+
+    float g_, k_;
+    float gInc_, kInc_;
+    size_t ramp_;
+
+    float a1_, a2_, a3_;
+    float m0_, m1_, m2_;
+    float mk_; // Part of m1 that follows k
+    float m0Inc_, m1Inc_, m2Inc_, mkInc_;
+    size_t mixRamp_;
+
+    float ic1_[N];
+    float ic2_[N];
+
+    inline void UpdateCoefficients()
+    {
+        a1_ = 1.f / (1.f + g_ * (g_ + k_));
+        a2_ = g_ * a1_;
+        a3_ = g_ * a2_;
+    }
+
+    inline void SetCoefficients(float freq, float q, size_t ramp)
+    {
+        if (freq == freq_ && q == q_)
+        {
+            return;
+        }
+
+        float g = TanLut::Get().Tan(freq, sampleRate_);
+        float k = 1.f / q;
+
+        // No ramp the first time, the filter would sweep from DC.
+        if (0 == ramp || freq_ < 0)
+        {
+            g_ = g;
+            k_ = k;
+            ramp_ = 0;
+            UpdateCoefficients();
+        }
+        else
+        {
+            gInc_ = (g - g_) / ramp;
+            kInc_ = (k - k_) / ramp;
+            ramp_ = ramp;
+        }
+
+        freq_ = freq;
+        q_ = q;
+    }
+
+    inline void SetMix(float m0, float m1, float m2, float mk, size_t ramp)
+    {
+        if (0 == ramp || freq_ < 0)
+        {
+            m0_ = m0;
+            m1_ = m1;
+            m2_ = m2;
+            mk_ = mk;
+            mixRamp_ = 0;
+        }
+        else
+        {
+            m0Inc_ = (m0 - m0_) / ramp;
+            m1Inc_ = (m1 - m1_) / ramp;
+            m2Inc_ = (m2 - m2_) / ramp;
+            mkInc_ = (mk - mk_) / ramp;
+            mixRamp_ = ramp;
+        }
+    }
+
+    inline void Step()
+    {
+        if (ramp_ > 0)
+        {
+            g_ += gInc_;
+            k_ += kInc_;
+            ramp_--;
+            UpdateCoefficients();
+        }
+        if (mixRamp_ > 0)
+        {
+            m0_ += m0Inc_;
+            m1_ += m1Inc_;
+            m2_ += m2Inc_;
+            mk_ += mkInc_;
+            mixRamp_--;
+        }
+    }
+
+    inline float Tick(size_t lane, float v0)
+    {
+        float v3 = v0 - ic2_[lane];
+        float v1 = a1_ * ic1_[lane] + a2_ * v3;
+        float v2 = ic2_[lane] + a2_ * ic1_[lane] + a3_ * v3;
+        ic1_[lane] = 2.f * v1 - ic1_[lane];
+        ic2_[lane] = 2.f * v2 - ic2_[lane];
+
+        return m0_ * v0 + (m1_ + mk_ * k_) * v1 + m2_ * v2;
+    }
+
+public:
+    PackedStateVariableFilter(float sampleRate)
+    {
+        sampleRate_ = sampleRate;
+        freq_ = q_ = -1.f;
+        g_ = gInc_ = kInc_ = 0;
+        k_ = 1.f;
+        ramp_ = mixRamp_ = 0;
+        UpdateCoefficients();
+        m0Inc_ = m1Inc_ = m2Inc_ = mkInc_ = 0;
+        m0_ = m1_ = mk_ = 0;
+        m2_ = 1.f;
+        Reset();
+    }
+    ~PackedStateVariableFilter() {}
+
+    static PackedStateVariableFilter* create(float sampleRate)
+    {
+        return new PackedStateVariableFilter(sampleRate);
+    }
+
+    static void destroy(PackedStateVariableFilter* obj)
+    {
+        delete obj;
+    }
+
+    void Reset()
+    {
+        for (size_t j = 0; j < N; j++)
+        {
+            ic1_[j] = ic2_[j] = 0;
+        }
+    }
+
+    /**
+     * @param ramp Number of samples over which the coefficients glide to the
+     *        new values, 0 to set them right away
+     */
+    void SetLowPass(float freq, float q, size_t ramp = 0)
+    {
+        SetCoefficients(freq, q, ramp);
+        SetMix(0, 0, 1.f, 0, 0);
+    }
+
+    void SetBandPass(float freq, float q, size_t ramp = 0)
+    {
+        SetCoefficients(freq, q, ramp);
+        SetMix(0, 1.f, 0, 0, 0);
+    }
+
+    void SetHighPass(float freq, float q, size_t ramp = 0)
+    {
+        SetCoefficients(freq, q, ramp);
+        SetMix(1.f, 0, -1.f, -1.f, 0);
+    }
+
+    /**
+     * @brief Blends the three responses of the same pass, the mix glides
+     *        with the coefficients.
+     *
+     * @param morph 0 is low pass, 1 band pass, 2 high pass
+     */
+    void SetMorph(float freq, float q, float morph, size_t ramp = 0)
+    {
+        float lp = Max(1.f - morph, 0.f);
+        float bp = 1.f - fabsf(morph - 1.f);
+        float hp = Max(morph - 1.f, 0.f);
+
+        // The mix is set first, it doesn't ramp before the first cutoff.
+        SetMix(hp, bp, lp - hp, -hp, ramp);
+        SetCoefficients(freq, q, ramp);
+    }
+
+    /**
+     * @brief Processes one sample for each lane.
+     */
+    inline void Process(const float* input, float* output)
+    {
+        Step();
+        for (size_t j = 0; j < N; j++)
+        {
+            output[j] = Tick(j, input[j]);
+        }
+    }
+
+    /**
+     * @brief Processes a block for each lane, input and output can be the
+     *        same.
+     */
+    inline void Process(const float* const* input, float* const* output, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            Step();
+            for (size_t j = 0; j < N; j++)
+            {
+                output[j][i] = Tick(j, input[j][i]);
+            }
+        }
+    }
+
+    /**
+     * @brief Processes a block following a per-sample cutoff, i.e. for audio
+     *        rate modulation. Cancels any running ramp.
+     *
+     * @param freqs Cutoff in Hz for each sample
+     */
+    inline void Process(const float* const* input, float* const* output, const float* freqs, size_t size)
+    {
+        const TanLut& lut = TanLut::Get();
+
+        ramp_ = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            g_ = lut.Tan(freqs[i], sampleRate_);
+            UpdateCoefficients();
+            for (size_t j = 0; j < N; j++)
+            {
+                output[j][i] = Tick(j, input[j][i]);
+            }
+        }
+        freq_ = freqs[size - 1];
+    }
+};
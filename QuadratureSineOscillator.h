@@ -0,0 +1,182 @@
+#pragma once
+
+#include "Commons.h"
+#include <stdint.h>
+#include <cmath>
+
+/**
+ * @brief Bank of N sines generated with a rotation recurrence: each lane
+ *        keeps the sine and cosine of its phase and rotates them by the
+ *        phase increment at every sample, which takes four multiplies
+ *        instead of a sine evaluation. Lanes are processed side by side.
+ *        Frequencies are set once per block and the rotation angle is ramped
+ *        linearly towards them: the rotation is itself rotated by the angle
+ *        increment at every sample, so it stays on the unit circle however
+ *        large the jump. The amplitude is renormalised at the beginning of
+ *        each block to stop it from drifting.
+ */
+template <size_t N>
+class QuadratureSineBank
+{
+private:
+    float sin_[N];
+    float cos_[N];
+
+    // Rotation for the current sample and the rotation of its angle
+    // between two samples.
+    float rotSin_[N];
+    float rotCos_[N];
+    float incSin_[N];
+    float incCos_[N];
+
+    // Rotation to reach at the end of the block.
+    float targetSin_[N];
+    float targetCos_[N];
+
+    float freqs_[N];
+    float angle_;
+
+    inline void Normalize()
+    {
+        for (size_t j = 0; j < N; j++)
+        {
+            // Single Newton iteration towards 1 / sqrt(s^2 + c^2), the
+            // error after a block is tiny.
+            float g = 1.5f - 0.5f * (sin_[j] * sin_[j] + cos_[j] * cos_[j]);
+            sin_[j] *= g;
+            cos_[j] *= g;
+        }
+    }
+
+public:
+    QuadratureSineBank(float sampleRate)
+    {
+        angle_ = 2.f * M_PI / sampleRate;
+
+        for (size_t j = 0; j < N; j++)
+        {
+            sin_[j] = 0;
+            cos_[j] = 1.f;
+            freqs_[j] = 0;
+            rotSin_[j] = targetSin_[j] = 0;
+            rotCos_[j] = targetCos_[j] = 1.f;
+            incSin_[j] = 0;
+            incCos_[j] = 1.f;
+        }
+    }
+    ~QuadratureSineBank() {}
+
+    static QuadratureSineBank* create(float sampleRate)
+    {
+        return new QuadratureSineBank(sampleRate);
+    }
+
+    static void destroy(QuadratureSineBank* obj)
+    {
+        delete obj;
+    }
+
+    /**
+     * @brief Sets the frequency of a lane immediately, without ramping.
+     */
+    void SetFrequency(size_t lane, float freq)
+    {
+        float w = freq * angle_;
+        freqs_[lane] = freq;
+        rotSin_[lane] = targetSin_[lane] = sinf(w);
+        rotCos_[lane] = targetCos_[lane] = cosf(w);
+        incSin_[lane] = 0;
+        incCos_[lane] = 1.f;
+    }
+
+    /**
+     * @brief Starts a new block: the rotation angle of each lane is ramped
+     *        from the previous frequency to the new one over the given number
+     *        of samples. Must be called once per block, before Generate().
+     */
+    void SetFrequencies(const float* freqs, size_t size)
+    {
+        Normalize();
+
+        float r = 1.f / size;
+        for (size_t j = 0; j < N; j++)
+        {
+            // Start exactly from the previous target, so that the
+            // increments' rounding doesn't accumulate.
+            rotSin_[j] = targetSin_[j];
+            rotCos_[j] = targetCos_[j];
+
+            if (freqs[j] != freqs_[j])
+            {
+                float w = freqs[j] * angle_;
+                float dw = (freqs[j] - freqs_[j]) * angle_ * r;
+                freqs_[j] = freqs[j];
+                targetSin_[j] = sinf(w);
+                targetCos_[j] = cosf(w);
+                incSin_[j] = sinf(dw);
+                incCos_[j] = cosf(dw);
+            }
+            else
+            {
+                incSin_[j] = 0;
+                incCos_[j] = 1.f;
+            }
+        }
+    }
+
+    /**
+     * @brief Writes the samples in [start, end) of each lane to the
+     *        corresponding output. Consecutive calls carry on where the
+     *        previous one stopped, so the block can be split.
+     */
+    inline void Generate(float** outputs, size_t start, size_t end)
+    {
+        for (size_t i = start; i < end; i++)
+        {
+            for (size_t j = 0; j < N; j++)
+            {
+                float s = sin_[j];
+                float c = cos_[j];
+
+                outputs[j][i] = s;
+
+                float rs = rotSin_[j];
+                float rc = rotCos_[j];
+                rotSin_[j] = rs * incCos_[j] + rc * incSin_[j];
+                rotCos_[j] = rc * incCos_[j] - rs * incSin_[j];
+
+                sin_[j] = s * rotCos_[j] + c * rotSin_[j];
+                cos_[j] = c * rotCos_[j] - s * rotSin_[j];
+            }
+        }
+    }
+
+    /**
+     * @brief Moves a lane to the phase that another one has at the next
+     *        sample to be generated.
+     */
+    inline void Align(size_t dst, size_t src)
+    {
+        sin_[dst] = sin_[src];
+        cos_[dst] = cos_[src];
+    }
+
+    /**
+     * @param phase Phase in radians
+     */
+    void SetPhase(size_t lane, float phase)
+    {
+        sin_[lane] = sinf(phase);
+        cos_[lane] = cosf(phase);
+    }
+
+    /**
+     * @return Phase in radians, in [0, 2pi)
+     */
+    float GetPhase(size_t lane)
+    {
+        float phase = atan2f(sin_[lane], cos_[lane]);
+
+        return phase < 0 ? phase + 2.f * M_PI : phase;
+    }
+};
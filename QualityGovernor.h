@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Commons.h"
+
+/**
+ * @brief Keeps an eye on the time spent processing each block and lowers the
+ *        quality of the most expensive settings when the load gets close to
+ *        the budget, one level at a time. The quality is raised back once
+ *        there's been enough headroom for a while.
+ *        The current level is kept in the patch state, where the modules
+ *        look up their settings for it.
+ */
+class QualityGovernor
+{
+private:
+    PatchState* patchState_;
+
+    float load_;
+
+    int holdBlocks_;
+    int restoreBlocks_;
+
+    void SetLevel(int level)
+    {
+        patchState_->qualityLevel = static_cast<QualityLevel>(level);
+    }
+
+public:
+    QualityGovernor(PatchState* patchState)
+    {
+        patchState_ = patchState;
+
+        load_ = 0;
+        holdBlocks_ = 0;
+        restoreBlocks_ = 0;
+
+        SetLevel(QUALITY_FULL);
+    }
+    ~QualityGovernor() {}
+
+    static QualityGovernor* create(PatchState* patchState)
+    {
+        return new QualityGovernor(patchState);
+    }
+
+    static void destroy(QualityGovernor* obj)
+    {
+        delete obj;
+    }
+
+    /**
+     * @param load Fraction of the block time used by the last block
+     */
+    void Process(float load)
+    {
+        // Follow the peaks, so that a single heavy block is enough to react.
+        load_ = Max(load, load_ * kQualityLoadRelease);
+
+        if (holdBlocks_ > 0)
+        {
+            holdBlocks_--;
+        }
+
+        int level = patchState_->qualityLevel;
+
+        if (load_ > kQualityLoadHigh)
+        {
+            restoreBlocks_ = 0;
+            // Wait for the previous change to show before lowering again.
+            if (holdBlocks_ == 0 && level < QUALITY_LAST - 1)
+            {
+                SetLevel(level + 1);
+                holdBlocks_ = kQualityHoldBlocks;
+            }
+        }
+        else if (load_ < kQualityLoadLow && level > QUALITY_FULL)
+        {
+            restoreBlocks_++;
+            if (restoreBlocks_ >= kQualityRestoreBlocks)
+            {
+                SetLevel(level - 1);
+                restoreBlocks_ = 0;
+                holdBlocks_ = kQualityHoldBlocks;
+            }
+        }
+        else
+        {
+            restoreBlocks_ = 0;
+        }
+    }
+};
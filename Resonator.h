@@ -1,172 +1,612 @@
 #pragma once
 
 #include "Commons.h"
-#include "DelayLine.h"
 #include "BiquadFilter.h"
 #include "EnvFollower.h"
-#include "DcBlockingFilter.h"
+#include "TanLut.h"
+#include "Bypass.h"
 
-class Pole
+/**
+ * @brief N resonant feedback loops as a structure of arrays, so that they
+ *        advance together. Each lane has a delay, a lowpass in the loop, a DC
+ *        blocker, a clipper and an envelope follower for infinite feedback,
+ *        and is fed by one of the two input channels. The delays are
+ *        interleaved in one buffer and indexed with a mask.
+ *        A lane whose gate is off stops taking the input and decays faster,
+ *        once its tail has died out it isn't processed anymore.
+ *
+ * @tparam N Number of lanes
+ */
+template <int N>
+class ResonatorLanes
 {
+private:
+    FloatArray line_; // Lanes interleaved
+    size_t w_;
+
+    // Lowpass, direct form 1.
+    float b0_[N], a1_[N], a2_[N];
+    float b0Target_[N], a1Target_[N], a2Target_[N];
+    float b0Inc_[N], a1Inc_[N], a2Inc_[N];
+    float x1_[N], x2_[N], y1_[N], y2_[N];
+
+    // DC blocker and envelope follower.
+    float dcX1_[N], dcY1_[N];
+    float ef_[N];
+
+
+    float delayTimes_[N], delayTargets_[N], delayIncs_[N];
+    float outs_[N];
+    float freqs_[N], lpFreqs_[N];
+    float feedbacks_[N], inputs_[N];
+    float peaks_[N];
+    size_t quiet_[N]; // Samples since the lane went below the threshold
+    int channels_[N];
+    bool gates_[N];
+    bool live_[N]; // Gated or still ringing
+
+    int active_[N]; // Lanes to process
+    int count_;
+    size_t ramp_;
+
+    float sampleRate_, msr_;
+    float reso_, lpReso_;
+    float feedback_;
+    float filter_;
+
+    // Shared by all the lanes, the tune knob is swept at audio rate.
+    static const InterpolatedLut<kResoLutSize>& DelayLut()
+    {
+        static const InterpolatedLut<kResoLutSize> lut(Db2A, kResoLutMin, kResoLutMax);
+
+        return lut;
+    }
+
+    static const InterpolatedLut<kResoLutSize>& FreqLut()
+    {
+        static const InterpolatedLut<kResoLutSize> lut(M2F, kResoLutMin, kResoLutMax);
+
+        return lut;
+    }
+
+    inline bool Retuned(float freq, float oldFreq)
+    {
+        return freq * kResoRetuneTolerance < oldFreq || freq > oldFreq * kResoRetuneTolerance;
+    }
+
+    /**
+     * @brief Same lowpass as the one of BiquadFilter (bilinear transform,
+     *        prewarped), a1 and a2 are negated. Sets the target of the
+     *        next ramp.
+     */
+    void SetLowPass(int lane, float freq)
+    {
+        float k = TanLut::Get().Tan(freq, sampleRate_);
+        float kk = k * k;
+        float norm = 1.f / (1.f + k / reso_ + kk);
+        b0Target_[lane] = kk * norm;
+        a1Target_[lane] = -2.f * (kk - 1.f) * norm;
+        a2Target_[lane] = -(1.f - k / reso_ + kk) * norm;
+    }
+
+    void SetFreq(int lane, bool force)
+    {
+        float f = freqs_[lane] + filter_;
+
+        // The lowpasses sit well above the note and just need to follow it
+        // roughly, skip the changes that wouldn't be heard.
+        if (force || Retuned(f, lpFreqs_[lane]))
+        {
+            lpFreqs_[lane] = f;
+            SetLowPass(lane, f);
+        }
+    }
+
+    void SetFreq()
+    {
+        bool reso = reso_ != lpReso_;
+        lpReso_ = reso_;
+
+        for (int j = 0; j < N; j++)
+        {
+            SetFreq(j, reso);
+        }
+    }
+
+    void SetLaneFeedback(int lane)
+    {
+        feedbacks_[lane] = gates_[lane] ? feedback_ : feedback_ * kResoReleaseFeedback;
+        inputs_[lane] = gates_[lane] ? 1.f : 0.f;
+    }
+
+    void UpdateActive()
+    {
+        count_ = 0;
+        for (int j = 0; j < N; j++)
+        {
+            if (live_[j])
+            {
+                active_[count_++] = j;
+            }
+        }
+    }
+
+    void Clear(int lane)
+    {
+        x1_[lane] = x2_[lane] = y1_[lane] = y2_[lane] = 0;
+        dcX1_[lane] = dcY1_[lane] = 0;
+        ef_[lane] = 0;
+        outs_[lane] = 0;
+        peaks_[lane] = 0;
+        quiet_[lane] = 0;
+    }
+
 public:
-    Pole(float sampleRate)
+    /**
+     * @param channels Input and output channel of each lane
+     */
+    ResonatorLanes(float sampleRate, const int* channels)
     {
         sampleRate_ = sampleRate;
         msr_ = sampleRate_ / 1000.f;
 
-        for (size_t i = 0; i < 2; i++)
-        {
-            delays_[i] = DelayLine::create(kResoBufferSize);
-            lpfs_[i] = BiquadFilter::create(sampleRate_);
-            dc_[i] = DcBlockingFilter::create();
-            ef_[i] = EnvFollower::create();
-        }
+        line_ = FloatArray::create(kResoLineSize * N);
+        line_.clear();
+        w_ = 0;
 
         reso_ = FilterStage::BUTTERWORTH_Q;
-        offset_ = 0;
+        lpReso_ = 0;
         feedback_ = 0;
         filter_ = 0;
-        detune_ = 0;
-    }
-    ~Pole()
-    {
-        for (size_t i = 0; i < 2; i++)
+
+        for (int j = 0; j < N; j++)
         {
-            DelayLine::destroy(delays_[i]);
-            BiquadFilter::destroy(lpfs_[i]);
-            DcBlockingFilter::destroy(dc_[i]);
-            EnvFollower::destroy(ef_[i]);
+            Clear(j);
+            channels_[j] = channels[j];
+            gates_[j] = false;
+            live_[j] = false;
+            lpFreqs_[j] = 0;
+            delayIncs_[j] = b0Inc_[j] = a1Inc_[j] = a2Inc_[j] = 0;
+            SetLaneFeedback(j);
+            SetNote(j, 0);
         }
+        ramp_ = 0;
+        Glide(0);
+        UpdateActive();
+    }
+    ~ResonatorLanes()
+    {
+        FloatArray::destroy(line_);
     }
 
-    static Pole* create(float sampleRate)
+    int GetChannel(int lane)
     {
-        return new Pole(sampleRate);
+        return channels_[lane];
     }
 
-    static void destroy(Pole* pole)
+    bool IsGated(int lane)
     {
-        delete pole;
+        return gates_[lane];
     }
 
-    float GetSemiOffset()
+    bool IsActive(int lane)
     {
-        return offset_;
+        return live_[lane];
     }
 
     /**
-     * @param offset Semitones, -24 to 24
+     * @param note Pole note, see PoleBank::SetSemiOffset
      */
-    void SetSemiOffset(float offset)
+    void SetNote(int lane, float note)
     {
-        offset_ = offset * -0.5f + 17.667f;
-        SetNote();
+        freqs_[lane] = FreqLut().Interpolate(note);
+
+        delayTargets_[lane] = Clamp(msr_ * DelayLut().Interpolate(note), 0, kResoBufferSize);
+
+        SetFreq(lane, reso_ != lpReso_);
+    }
+
+    /**
+     * @brief Opens or closes the lane. An open lane that was silent jumps
+     *        right away to its note.
+     */
+    void SetGate(int lane, bool gate)
+    {
+        if (gate == gates_[lane])
+        {
+            return;
+        }
+        gates_[lane] = gate;
+        SetLaneFeedback(lane);
+
+        if (gate && !live_[lane])
+        {
+            Clear(lane);
+            delayTimes_[lane] = delayTargets_[lane];
+            delayIncs_[lane] = 0;
+            b0_[lane] = b0Target_[lane];
+            a1_[lane] = a1Target_[lane];
+            a2_[lane] = a2Target_[lane];
+            b0Inc_[lane] = a1Inc_[lane] = a2Inc_[lane] = 0;
+            live_[lane] = true;
+            UpdateActive();
+        }
     }
 
     void SetFilter(float filter)
     {
+        if (filter == filter_)
+        {
+            return;
+        }
         filter_ = filter;
         SetFreq();
     }
 
-    void SetFeedback(float feedback)
+    void SetReso(float reso)
     {
-        feedback_ = feedback;
+        if (reso == reso_)
+        {
+            return;
+        }
+        reso_ = reso;
+        SetFreq();
+    }
 
+    void SetFeedback(float feedback)
+    {
         // Infinite feedback.
-        if (feedback_ > kResoInfiniteFeedbackThreshold)
+        if (feedback > kResoInfiniteFeedbackThreshold)
+        {
+            feedback = kResoInfiniteFeedbackLevel;
+        }
+        else if (feedback > 0.99f)
         {
-            feedback_ = kResoInfiniteFeedbackLevel;
+            feedback = 1.f;
         }
-        else if (feedback_ > 0.99f)
+
+        if (feedback == feedback_)
+        {
+            return;
+        }
+        feedback_ = feedback;
+        for (int j = 0; j < N; j++)
         {
-            feedback_ = 1.f;
+            SetLaneFeedback(j);
         }
     }
 
-    void SetDissonance(float detune)
+    /**
+     * @brief Starts moving the delay times and the lowpasses towards the
+     *        values set since the last call. Any lowpass in between two
+     *        stable ones is stable, so the coefficients can be interpolated
+     *        linearly.
+     *
+     * @param ramp Number of samples of the glide, 0 to jump right away
+     */
+    void Glide(size_t ramp)
     {
-        detune_ = detune;
-        SetNote();
+        if (0 == ramp)
+        {
+            for (int j = 0; j < N; j++)
+            {
+                delayTimes_[j] = delayTargets_[j];
+                b0_[j] = b0Target_[j];
+                a1_[j] = a1Target_[j];
+                a2_[j] = a2Target_[j];
+            }
+            ramp_ = 0;
+
+            return;
+        }
+
+        float r = 1.f / ramp;
+        for (int j = 0; j < N; j++)
+        {
+            delayIncs_[j] = (delayTargets_[j] - delayTimes_[j]) * r;
+            b0Inc_[j] = (b0Target_[j] - b0_[j]) * r;
+            a1Inc_[j] = (a1Target_[j] - a1_[j]) * r;
+            a2Inc_[j] = (a2Target_[j] - a2_[j]) * r;
+        }
+        ramp_ = ramp;
     }
 
-    void SetReso(float reso)
+    /**
+     * @brief Advances the active lanes by one sample.
+     *
+     * @param output Output of each lane, untouched for the silent ones
+     */
+    inline void Process(float leftIn, float rightIn, float* output)
     {
-        reso_ = reso;
-        SetFreq();
+        float* line = line_.getData();
+
+        if (ramp_ > 0)
+        {
+            for (int k = 0; k < count_; k++)
+            {
+                int j = active_[k];
+                delayTimes_[j] += delayIncs_[j];
+                b0_[j] += b0Inc_[j];
+                a1_[j] += a1Inc_[j];
+                a2_[j] += a2Inc_[j];
+            }
+            ramp_--;
+        }
+
+        float mix[N];
+        for (int k = 0; k < count_; k++)
+        {
+            int j = active_[k];
+            float x = outs_[j];
+            float y = b0_[j] * (x + 2.f * x1_[j] + x2_[j]) + a1_[j] * y1_[j] + a2_[j] * y2_[j];
+            x2_[j] = x1_[j];
+            x1_[j] = x;
+            y2_[j] = y1_[j];
+            y1_[j] = y;
+            output[j] = y * feedbacks_[j];
+
+            float in = (LEFT_CHANNEL == channels_[j] ? leftIn : rightIn) * inputs_[j] + output[j];
+            dcY1_[j] = in - dcX1_[j] + 0.995f * dcY1_[j];
+            dcX1_[j] = in;
+        }
+        for (int k = 0; k < count_; k++)
+        {
+            int j = active_[k];
+            mix[j] = HardClip(dcY1_[j]);
+
+            // Handle infinite feedback.
+            if (feedbacks_[j] == kResoInfiniteFeedbackLevel)
+            {
+                ef_[j] = ef_[j] * 0.995f + fabsf(HardClip(mix[j])) * 0.005f;
+                mix[j] *= 1.095f - Clamp(ef_[j]);
+            }
+
+            peaks_[j] = Max(peaks_[j], fabsf(mix[j]));
+        }
+
+        size_t p = (w_ & (kResoLineSize - 1)) * N;
+        for (int k = 0; k < count_; k++)
+        {
+            int j = active_[k];
+            line[p + j] = mix[j];
+        }
+
+        // Read back, the sample just written is at delay 0. The writes are
+        // already clipped, so the reads don't need a clamp.
+        for (int k = 0; k < count_; k++)
+        {
+            int j = active_[k];
+            float d = delayTimes_[j];
+            size_t idx = (size_t)d;
+            float frac = d - idx;
+            float y0 = line[((w_ - idx) & (kResoLineSize - 1)) * N + j];
+            float y1 = line[((w_ - idx - 1) & (kResoLineSize - 1)) * N + j];
+            outs_[j] = y0 + (y1 - y0) * frac;
+        }
+
+        w_++;
     }
 
-    // Process just one of the two channels.
-    float Process(float in, int channel)
+    /**
+     * @brief Called at block rate, drops the closed lanes that have been
+     *        silent for longer than the longest delay. Their delay is left as
+     *        it is, it's below the threshold.
+     *
+     * @param size Samples processed since the last call
+     */
+    void Update(size_t size)
     {
-        float out = lpfs_[channel]->process(outs_[channel]) * feedback_;
+        bool changed = false;
+        for (int k = 0; k < count_; k++)
+        {
+            int j = active_[k];
+            quiet_[j] = peaks_[j] < kBypassTailThreshold ? quiet_[j] + size : 0;
+            peaks_[j] = 0;
+            if (!gates_[j] && quiet_[j] > kResoBufferSize)
+            {
+                Clear(j);
+                live_[j] = false;
+                changed = true;
+            }
+        }
+        if (changed)
+        {
+            UpdateActive();
+        }
+    }
+};
 
-        float mix = HardClip(dc_[channel]->process(in + out));
+// The first pole runs in stereo, the second and the third only on the left
+// and the right channel respectively.
+const int kResoPoleLanes[kResoLanes] = { 0, 0, 1, 2 };
+const int kResoPoleChannels[kResoLanes] = { LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL };
 
-        // Handle infinite feedback.
-        if (feedback_ == kResoInfiniteFeedbackLevel)
+// The voices alternate between the two channels.
+const int kResoVoiceChannels[kResoMaxVoices] = { LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL, LEFT_CHANNEL, RIGHT_CHANNEL };
+
+/**
+ * @brief The three poles tuned by the tune and the dissonance knobs, each
+ *        one is detuned up on the left and down on the right.
+ */
+class PoleBank : public ResonatorLanes<kResoLanes>
+{
+private:
+    float offsets_[kResoPoles];
+    float detunes_[kResoPoles];
+
+    void SetPoleNote(int pole)
+    {
+        for (int j = 0; j < kResoLanes; j++)
         {
-            mix *= 1.095f - ef_[channel]->process(mix);
+            if (kResoPoleLanes[j] == pole)
+            {
+                SetNote(j, offsets_[pole] + (LEFT_CHANNEL == kResoPoleChannels[j] ? detunes_[pole] : -detunes_[pole]));
+            }
         }
+    }
 
-        delays_[channel]->write(mix);
-        outs_[channel] = delays_[channel]->read(delayTimes_[channel]);
-
-        return out;
+public:
+    PoleBank(float sampleRate) : ResonatorLanes<kResoLanes>(sampleRate, kResoPoleChannels)
+    {
+        for (int i = 0; i < kResoPoles; i++)
+        {
+            offsets_[i] = 0;
+            detunes_[i] = 0;
+            SetPoleNote(i);
+        }
+        SetGate(true);
     }
+    ~PoleBank() {}
 
-    void Process(float leftIn, float rightIn, float &leftOut, float &rightOut)
+    static PoleBank* create(float sampleRate)
     {
-        leftOut = lpfs_[LEFT_CHANNEL]->process(outs_[LEFT_CHANNEL]) * feedback_;
-        rightOut = lpfs_[RIGHT_CHANNEL]->process(outs_[RIGHT_CHANNEL]) * feedback_;
+        return new PoleBank(sampleRate);
+    }
 
-        float leftMix = HardClip(dc_[LEFT_CHANNEL]->process(leftIn + leftOut));
-        float rightMix = HardClip(dc_[RIGHT_CHANNEL]->process(rightIn + rightOut));
+    static void destroy(PoleBank* bank)
+    {
+        delete bank;
+    }
 
-        // Handle infinite feedback.
-        if (feedback_ == kResoInfiniteFeedbackLevel)
+    /**
+     * @brief Opens or closes all the poles.
+     */
+    void SetGate(bool gate)
+    {
+        for (int j = 0; j < kResoLanes; j++)
         {
-            leftMix *= 1.095f - ef_[LEFT_CHANNEL]->process(leftMix);
-            rightMix *= 1.095f - ef_[RIGHT_CHANNEL]->process(rightMix);
+            ResonatorLanes<kResoLanes>::SetGate(j, gate);
         }
+    }
 
-        delays_[LEFT_CHANNEL]->write(leftMix);
-        delays_[RIGHT_CHANNEL]->write(rightMix);
+    float GetSemiOffset(int pole)
+    {
+        return offsets_[pole];
+    }
 
-        outs_[LEFT_CHANNEL] = delays_[LEFT_CHANNEL]->read(delayTimes_[LEFT_CHANNEL]);
-        outs_[RIGHT_CHANNEL] = delays_[RIGHT_CHANNEL]->read(delayTimes_[RIGHT_CHANNEL]);
+    /**
+     * @param offset Semitones, -24 to 24
+     */
+    void SetSemiOffset(int pole, float offset)
+    {
+        offset = offset * -0.5f + kResoPoleRoot;
+        if (offset == offsets_[pole])
+        {
+            return;
+        }
+        offsets_[pole] = offset;
+        SetPoleNote(pole);
     }
 
+    void SetDissonance(int pole, float detune)
+    {
+        if (detune == detunes_[pole])
+        {
+            return;
+        }
+        detunes_[pole] = detune;
+        SetPoleNote(pole);
+    }
+};
+
+/**
+ * @brief Mono voices tuned by the notes held on the MIDI input. A voice is
+ *        closed when its note is released and then rings out, it's taken
+ *        back by a new note only when no silent voice is left.
+ */
+class VoiceBank : public ResonatorLanes<kResoMaxVoices>
+{
 private:
-    DelayLine *delays_[2];
-    BiquadFilter *lpfs_[2];
-    EnvFollower *ef_[2];
-    DcBlockingFilter* dc_[2];
-    float delayTimes_[2], outs_[2];
+    int notes_[kResoMaxVoices];
 
-    float sampleRate_, msr_;
-    float lf_, rf_;
-    float reso_;
-    float offset_;
-    float feedback_;
-    float filter_;
-    float detune_;
+    int FreeVoice(int note)
+    {
+        // A voice still ringing with the same note is picked up again.
+        for (int j = 0; j < kResoMaxVoices; j++)
+        {
+            if (IsActive(j) && !IsGated(j) && note == notes_[j])
+            {
+                return j;
+            }
+        }
 
-    void SetFreq()
+        int ringing = -1;
+        for (int j = 0; j < kResoMaxVoices; j++)
+        {
+            if (!IsActive(j))
+            {
+                return j;
+            }
+            if (!IsGated(j) && ringing < 0)
+            {
+                ringing = j;
+            }
+        }
+
+        return ringing;
+    }
+
+public:
+    VoiceBank(float sampleRate) : ResonatorLanes<kResoMaxVoices>(sampleRate, kResoVoiceChannels)
     {
-        lpfs_[LEFT_CHANNEL]->setLowPass(M2F(lf_) + filter_, reso_);
-        lpfs_[RIGHT_CHANNEL]->setLowPass(M2F(rf_) + filter_, reso_);
+        for (int j = 0; j < kResoMaxVoices; j++)
+        {
+            notes_[j] = -1;
+        }
     }
+    ~VoiceBank() {}
 
-    void SetNote()
+    static VoiceBank* create(float sampleRate)
     {
-        lf_ = offset_ + detune_;
-        rf_ = offset_ - detune_;
+        return new VoiceBank(sampleRate);
+    }
 
-        delayTimes_[LEFT_CHANNEL] = Clamp(msr_ * Db2A(lf_), 0, kResoBufferSize);
-        delayTimes_[RIGHT_CHANNEL] = Clamp(msr_ * Db2A(rf_), 0, kResoBufferSize);
+    static void destroy(VoiceBank* bank)
+    {
+        delete bank;
+    }
 
-        SetFreq();
+    /**
+     * @brief Follows the held notes, called at block rate.
+     */
+    void SetNotes(const NoteStack& notes)
+    {
+        // Release the voices whose note is not held anymore.
+        for (int j = 0; j < kResoMaxVoices; j++)
+        {
+            if (IsGated(j) && !notes.Contains(notes_[j]))
+            {
+                SetGate(j, false);
+            }
+        }
+
+        for (size_t i = 0; i < notes.Size(); i++)
+        {
+            int note = notes.Note(i);
+
+            bool held = false;
+            for (int j = 0; j < kResoMaxVoices; j++)
+            {
+                if (IsGated(j) && note == notes_[j])
+                {
+                    held = true;
+                    break;
+                }
+            }
+            if (held)
+            {
+                continue;
+            }
+
+            int j = FreeVoice(note);
+            if (j < 0)
+            {
+                break;
+            }
+            notes_[j] = note;
+            SetNote(j, (note - kResoMidiRoot) * -0.5f + kResoPoleRoot);
+            SetGate(j, true);
+        }
     }
 };
 
@@ -181,10 +621,12 @@ private:
     PatchCtrls* patchCtrls_;
     PatchCvs* patchCvs_;
     PatchState* patchState_;
-    Pole* poles_[3];
+    PoleBank* poles_;
+    VoiceBank* voices_;
 
     BiquadFilter *notches_[2];
     EnvFollower *ef_[2];
+    Bypass* bypass_;
 
     float amp_;
     float dryWet_;
@@ -193,7 +635,6 @@ private:
     float oldTuning_;
     int ranges_[3];
 
-    int task_;
 
     /**
      * @param idx 0 - 3
@@ -203,18 +644,18 @@ private:
     {
         if (idx == 0)
         {
-            poles_[0]->SetSemiOffset(offset);
-            poles_[1]->SetSemiOffset(offset + poles_[1]->GetSemiOffset());
-            poles_[2]->SetSemiOffset(offset + poles_[2]->GetSemiOffset());
+            poles_->SetSemiOffset(0, offset);
+            poles_->SetSemiOffset(1, offset + poles_->GetSemiOffset(1));
+            poles_->SetSemiOffset(2, offset + poles_->GetSemiOffset(2));
 
         }
         else if (idx == 1)
         {
-            poles_[1]->SetSemiOffset(offset + poles_[1]->GetSemiOffset());
+            poles_->SetSemiOffset(1, offset + poles_->GetSemiOffset(1));
         }
         else if (idx == 2)
         {
-            poles_[2]->SetSemiOffset(offset + poles_[2]->GetSemiOffset());
+            poles_->SetSemiOffset(2, offset + poles_->GetSemiOffset(2));
         }
     }
 
@@ -222,29 +663,24 @@ private:
     {
         tune_ = value;
 
-        // Spread the updates in time.
-        task_ = (task_ + 1) % 6;
-        if (task_ == 0)
+        SetSemiOffset(0, Map(tune_, 0.f, 1.f, -24, ranges_[0]));
+        if (tune_ < 0.5f)
         {
-            SetSemiOffset(0, Map(tune_, 0.f, 1.f, -24, ranges_[0]));
+            SetSemiOffset(1, Map(tune_, 0.f, 0.5f, -12, ranges_[1]));
         }
-        if (tune_ < 0.5f && task_ == 1)
+        else
         {
-            SetSemiOffset(1, Map(tune_, 0.f, 0.5f, -12, ranges_[1]));
+            SetSemiOffset(1, Map(tune_, 0.5f, 1.f, -12, ranges_[1]));
         }
-        if (tune_ < 0.3f && task_ == 2)
+        if (tune_ < 0.3f)
         {
             SetSemiOffset(2, Map(tune_, 0.f, 0.3f, -6, ranges_[2]));
         }
-        if (tune_ >= 0.3f && tune_ < 0.7f && task_ == 3)
+        else if (tune_ < 0.7f)
         {
             SetSemiOffset(2, Map(tune_, 0.3f, 0.7f, -6, ranges_[2]));
         }
-        if (tune_ >= 0.5f && task_ == 4)
-        {
-            SetSemiOffset(1, Map(tune_, 0.5f, 1.f, -12, ranges_[1]));
-        }
-        if (tune_ >= 0.7f && task_ == 5)
+        else
         {
             SetSemiOffset(2, Map(tune_, 0.7f, 1.f, -6, ranges_[2]));
         }
@@ -256,12 +692,12 @@ private:
         float reso = Map(value, 0.f, 1.f, 0.5f, 0.6f);
         float filter = Map(value, 0.f, 1.f, 5000.f, 10000.f);
         amp_ = Map(value, 0.f, 1.f, kResoGainMax, kResoGainMin) * 0.577f;
-        for (int i = 0; i < 3; i++)
-        {
-            poles_[i]->SetFeedback(feedback);
-            poles_[i]->SetReso(reso);
-            poles_[i]->SetFilter(filter);
-        }
+        poles_->SetFeedback(feedback);
+        poles_->SetReso(reso);
+        poles_->SetFilter(filter);
+        voices_->SetFeedback(feedback);
+        voices_->SetReso(reso);
+        voices_->SetFilter(filter);
     }
 
     /*
@@ -277,9 +713,9 @@ private:
         ranges_[1] = Map(value, 0.f, 1.f, 12, 7);
         ranges_[2] = Map(value, 0.f, 1.f, 6, 13);
 
-        poles_[0]->SetDissonance(value);
-        poles_[1]->SetDissonance(value * 2.f);
-        poles_[2]->SetDissonance(value * 3.f);
+        poles_->SetDissonance(0, value);
+        poles_->SetDissonance(1, value * 2.f);
+        poles_->SetDissonance(2, value * 3.f);
     }
 
 public:
@@ -289,10 +725,8 @@ public:
         patchCvs_ = patchCvs;
         patchState_ = patchState;
 
-        for (int i = 0; i < 3; i++)
-        {
-            poles_[i] = Pole::create(patchState_->sampleRate);
-        }
+        poles_ = PoleBank::create(patchState_->sampleRate);
+        voices_ = VoiceBank::create(patchState_->sampleRate);
 
         for (size_t i = 0; i < 2; i++)
         {
@@ -301,25 +735,27 @@ public:
             ef_[i] = EnvFollower::create();
         }
 
+        bypass_ = Bypass::create(patchState_->blockSize, kResoBufferSize);
+
         amp_ = 1.f;
         range_ = 1.f;
-        task_ = 0;
 
         SetDissonance(0);
         SetTune(0);
         SetFeedback(0);
+        poles_->Glide(0);
+        voices_->Glide(0);
     }
     ~Resonator()
     {
-        for (int i = 0; i < 3; i++)
-        {
-            Pole::destroy(poles_[i]);
-        }
+        PoleBank::destroy(poles_);
+        VoiceBank::destroy(voices_);
         for (size_t i = 0; i < 2; i++)
         {
             BiquadFilter::destroy(notches_[i]);
             EnvFollower::destroy(ef_[i]);
         }
+        Bypass::destroy(bypass_);
     }
 
     static Resonator* create(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
@@ -340,32 +776,67 @@ public:
         FloatArray leftOut = output.getSamples(LEFT_CHANNEL);
         FloatArray rightOut = output.getSamples(RIGHT_CHANNEL);
 
+        if (!bypass_->Process(patchCtrls_->resonatorVol))
+        {
+            if (&input != &output)
+            {
+                output.copyFrom(input);
+            }
+
+            return;
+        }
+
         SetDissonance(patchCtrls_->resonatorDissonance);
 
         float t = Modulate(patchCtrls_->resonatorTune, patchCtrls_->resonatorTuneModAmount, patchState_->modValue, patchCtrls_->resonatorTuneCvAmount, patchCvs_->resonatorTune, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        ParameterInterpolator tuningParam(&oldTuning_, t, size);
+        ParameterInterpolator tuningParam(&oldTuning_, t, (size + kResoTuneInterval - 1) / kResoTuneInterval);
 
         float f = Modulate(patchCtrls_->resonatorFeedback, patchCtrls_->resonatorFeedbackModAmount, patchState_->modValue, patchCtrls_->resonatorFeedbackCvAmount, patchCvs_->resonatorFeedback, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
         SetFeedback(f);
 
+        // Bank mode while notes are held, the poles and the voices ring out
+        // when they're closed.
+        bool bank = patchState_->heldNotes.Size() > 0;
+        poles_->SetGate(!bank);
+        voices_->SetNotes(patchState_->heldNotes);
+
         for (size_t i = 0; i < size; i++)
         {
-            SetTune(tuningParam.Next());
+            // Retune at control rate, the poles glide in between.
+            if (0 == i % kResoTuneInterval)
+            {
+                SetTune(tuningParam.Next());
+                poles_->Glide(kResoTuneInterval);
+                voices_->Glide(kResoTuneInterval);
+            }
 
             float lIn = Clamp(leftIn[i], -3.f, 3.f);
             float rIn = Clamp(rightIn[i], -3.f, 3.f);
-
-            float left = poles_[1]->Process(lIn, LEFT_CHANNEL);
-            float right = poles_[2]->Process(rIn, RIGHT_CHANNEL);
-
-            float oLeft = left * 0.75f + right * 0.25f;
-            float oRight = left * 0.25f + right * 0.75f;
-
-            left = 0;
-            right = 0;
-            poles_[0]->Process(lIn, rIn, left, right);
-            oLeft += left;
-            oRight += right;
+            float g = bypass_->InputGain();
+            float lFeed = lIn * g;
+            float rFeed = rIn * g;
+
+            float outs[kResoLanes] = {};
+            poles_->Process(lFeed, rFeed, outs);
+
+            // The second and the third pole are panned, the first one is
+            // stereo.
+            float oLeft = outs[2] * 0.75f + outs[3] * 0.25f + outs[0];
+            float oRight = outs[2] * 0.25f + outs[3] * 0.75f + outs[1];
+
+            float voices[kResoMaxVoices] = {};
+            voices_->Process(lFeed, rFeed, voices);
+
+            // Likewise for the voices.
+            float vLeft = 0;
+            float vRight = 0;
+            for (int j = 0; j < kResoMaxVoices; j += 2)
+            {
+                vLeft += voices[j];
+                vRight += voices[j + 1];
+            }
+            oLeft += vLeft * 0.75f + vRight * 0.25f;
+            oRight += vLeft * 0.25f + vRight * 0.75f;
 
             oLeft *= 1.f - ef_[LEFT_CHANNEL]->process(oLeft);
             oRight *= 1.f - ef_[RIGHT_CHANNEL]->process(oRight);
@@ -376,8 +847,13 @@ public:
             oLeft = notches_[LEFT_CHANNEL]->process(oLeft);
             oRight = notches_[RIGHT_CHANNEL]->process(oRight);
 
+            bypass_->Track(oLeft, oRight);
+
             leftOut[i] = CheapEqualPowerCrossFade(lIn, oLeft * kResoMakeupGain, patchCtrls_->resonatorVol, 1.4f);
             rightOut[i] = CheapEqualPowerCrossFade(rIn, oRight * kResoMakeupGain, patchCtrls_->resonatorVol, 1.4f);
         }
+
+        poles_->Update(size);
+        voices_->Update(size);
     }
 };
\ No newline at end of file
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "Commons.h"
-#include "SineOscillator.h"
+#include "QuadratureSineOscillator.h"
 #include "Schmitt.h"
 
 class StereoSineOscillator
@@ -11,11 +11,11 @@ private:
     PatchCvs* patchCvs_;
     PatchState* patchState_;
 
-    SineOscillator* oscs_[2];
+    QuadratureSineBank<2>* oscs_;
 
     Schmitt trigger_;
 
-    float oldFreqs_[2];
+    FloatArray sine2_;
 
     bool fadeOut_, fadeIn_;
     float sine1Volume_, sine2Volume_;
@@ -48,10 +48,9 @@ public:
         patchCvs_ = patchCvs;
         patchState_ = PatchState;
 
-        for (size_t i = 0; i < 2; i++)
-        {
-            oscs_[i] = SineOscillator::create(patchState_->sampleRate);
-        }
+        oscs_ = QuadratureSineBank<2>::create(patchState_->sampleRate);
+
+        sine2_ = FloatArray::create(patchState_->blockSize);
 
         fadeOut_ = false;
         fadeIn_ = false;
@@ -60,10 +59,8 @@ public:
     }
     ~StereoSineOscillator()
     {
-        for (size_t i = 0; i < 2; i++)
-        {
-            SineOscillator::destroy(oscs_[i]);
-        }
+        QuadratureSineBank<2>::destroy(oscs_);
+        FloatArray::destroy(sine2_);
     }
 
     static StereoSineOscillator* create(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* PatchState)
@@ -93,35 +90,61 @@ public:
         float f[2];
         f[0] = Clamp(patchCtrls_->oscPitch, kOscFreqMin, kOscFreqMax);
         f[1] = Clamp(f[0] * u, kOscFreqMin, kOscFreqMax);
-        ParameterInterpolator freqParams[2] = {ParameterInterpolator(&oldFreqs_[0], f[0], size), ParameterInterpolator(&oldFreqs_[1], f[1], size)};
+        oscs_->SetFrequencies(f, size);
 
-        for (size_t i = 0; i < size; i++)
+        if (trigger_.Process(patchState_->oscUnisonCenterFlag) && !fadeOut_)
         {
-            for (size_t j = 0; j < 2; j++)
-            {
-                oscs_[j]->setFrequency(freqParams[j].Next());
-            }
+            fadeOut_ = true;
+        }
 
-            if (trigger_.Process(patchState_->oscUnisonCenterFlag) && !fadeOut_)
-            {
-                fadeOut_ = true;
-            }
+        FloatArray left = output.getSamples(LEFT_CHANNEL);
+        FloatArray right = output.getSamples(RIGHT_CHANNEL);
+
+        // The second sine's volume is computed first (and kept in the right
+        // channel), because while it fades in its phase follows the first
+        // one's and it must be aligned on the last sample of the fade.
+        int alignStart = -1;
+        int alignEnd = -1;
+        for (size_t i = 0; i < size; i++)
+        {
             if (fadeOut_)
             {
                 FadeOut();
             }
             else if (fadeIn_)
             {
-                oscs_[1]->setPhase(oscs_[0]->getPhase());
+                if (alignStart < 0)
+                {
+                    alignStart = i;
+                }
+                alignEnd = i;
                 FadeIn();
             }
+            right[i] = sine2Volume_;
+        }
 
-            float out = oscs_[0]->generate() * sine1Volume_ + oscs_[1]->generate() * sine2Volume_;
-
-            out *= patchCtrls_->osc1Vol * kOScSineGain;
+        float* sines[2] = {left.getData(), sine2_.getData()};
+        if (alignEnd >= 0)
+        {
+            oscs_->Generate(sines, 0, alignEnd);
+            oscs_->Align(1, 0);
+            oscs_->Generate(sines, alignEnd, size);
+            for (int i = alignStart; i < alignEnd; i++)
+            {
+                sine2_[i] = left[i];
+            }
+        }
+        else
+        {
+            oscs_->Generate(sines, 0, size);
+        }
 
-            output.getSamples(LEFT_CHANNEL).setElement(i, out);
-            output.getSamples(RIGHT_CHANNEL).setElement(i, out);
+        float gain = patchCtrls_->osc1Vol * kOScSineGain;
+        for (size_t i = 0; i < size; i++)
+        {
+            float out = (left[i] * sine1Volume_ + sine2_[i] * right[i]) * gain;
+            left[i] = out;
+            right[i] = out;
         }
     }
-};
\ No newline at end of file
+};
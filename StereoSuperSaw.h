@@ -2,6 +2,7 @@
 
 #include "Commons.h"
 #include "RampOscillator.h"
+#include "HalfBand.h"
 
 /**
  * @brief 7 sawtooth oscillators with detuning and mixing.
@@ -15,8 +16,10 @@ private:
   AntialiasedRampOscillator* oscs_[7];
   float detunes_[7];
   float volumes_[7];
-  float oldFreq_;
+  float phases_[7];
+  float oldFreq_, savedFreq_;
   float detune_;
+  int firstVoice_, lastVoice_;
 
 public:
     SuperSaw(float sampleRate)
@@ -28,6 +31,8 @@ public:
             volumes_[i] = 0;
         }
         detune_ = 0;
+        firstVoice_ = 0;
+        lastVoice_ = 7;
     }
     ~SuperSaw()
     {
@@ -45,6 +50,18 @@ public:
         }
     }
 
+    /**
+     * @brief Sets how many of the voices are generated, starting from the
+     *        center one and adding the detuned pairs.
+     *
+     * @param voices 1, 3, 5 or 7
+     */
+    void SetVoices(int voices)
+    {
+        firstVoice_ = (7 - voices) / 2;
+        lastVoice_ = 7 - firstVoice_;
+    }
+
     void SetDetune(float value, bool minor = false)
     {
         detune_ = value * 0.4f;
@@ -82,6 +99,28 @@ public:
         volumes_[6] = y;
     }
 
+    /**
+     * @brief Keeps the phases, to render the next block again with
+     *        RestoreState().
+     */
+    void SaveState()
+    {
+        for (size_t i = 0; i < 7; i++)
+        {
+            phases_[i] = oscs_[i]->getPhase();
+        }
+        savedFreq_ = oldFreq_;
+    }
+
+    void RestoreState()
+    {
+        for (size_t i = 0; i < 7; i++)
+        {
+            oscs_[i]->setPhase(phases_[i]);
+        }
+        oldFreq_ = savedFreq_;
+    }
+
     static SuperSaw* create(float sampleRate)
     {
         return new SuperSaw(sampleRate);
@@ -92,22 +131,38 @@ public:
         delete obj;
     }
 
-    void Process(float freq, FloatArray output)
+    /**
+     * @param oversampling Factor of the rate the output is rendered at
+     */
+    void Process(float freq, FloatArray output, int oversampling = 1)
     {
         size_t size = output.getSize();
+        float r = 1.f / oversampling;
 
         ParameterInterpolator freqParam(&oldFreq_, freq, size);
 
+        // Compensate the level of the voices that are left out.
+        float total = 0;
+        float active = 0;
+        for (int j = 0; j < 7; j++)
+        {
+            total += volumes_[j];
+            if (j >= firstVoice_ && j < lastVoice_)
+            {
+                active += volumes_[j];
+            }
+        }
+
         for (size_t i = 0; i < size; i++)
         {
-            SetFreq(freqParam.Next());
-            for (size_t j = 0; j < 7; j++)
+            SetFreq(freqParam.Next() * r);
+            for (int j = firstVoice_; j < lastVoice_; j++)
             {
                 output[i] += oscs_[j]->generate() * volumes_[j];
             }
         }
 
-        output.multiply(0.3f * (1.4f - detune_));
+        output.multiply(0.3f * (1.4f - detune_) * total / active);
     }
 };
 
@@ -118,6 +173,14 @@ private:
     PatchCvs* patchCvs_;
     PatchState* patchState_;
     SuperSaw* saws_[2];
+    StereoDecimator* decimator_;
+    StereoDecimator* fadeDecimator_;
+    AudioBuffer* oversampled_;
+    AudioBuffer* fade_;
+
+    int oversampling_;
+    int voices_;
+    float xi_;
 
     void SetDetune(float value, bool minor = false)
     {
@@ -127,6 +190,28 @@ private:
         }
     }
 
+    /**
+     * @brief Adds a block rendered at the given factor and with the given
+     *        number of voices to the output.
+     */
+    void Render(AudioBuffer &output, float freq, int factor, int voices, StereoDecimator* decimator)
+    {
+        saws_[LEFT_CHANNEL]->SetVoices(voices);
+        saws_[RIGHT_CHANNEL]->SetVoices(voices);
+
+        // At 1x the saws are rendered in place and the decimator only keeps
+        // track of the factor.
+        AudioBuffer* saws = 1 == factor ? &output : oversampled_;
+        size_t size = output.getSize() * factor;
+        if (factor > 1)
+        {
+            oversampled_->clear();
+        }
+        saws_[LEFT_CHANNEL]->Process(freq, saws->getSamples(LEFT_CHANNEL).subArray(0, size), factor);
+        saws_[RIGHT_CHANNEL]->Process(freq, saws->getSamples(RIGHT_CHANNEL).subArray(0, size), factor);
+        decimator->Process(*saws, output, factor);
+    }
+
 public:
     StereoSuperSaw(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
     {
@@ -138,6 +223,14 @@ public:
         {
             saws_[i] = SuperSaw::create(patchState_->sampleRate);
         }
+
+        decimator_ = StereoDecimator::create(patchState_->blockSize);
+        fadeDecimator_ = StereoDecimator::create(patchState_->blockSize);
+        oversampled_ = AudioBuffer::create(2, patchState_->blockSize * 4);
+        fade_ = AudioBuffer::create(2, patchState_->blockSize);
+        oversampling_ = 1;
+        voices_ = 7;
+        xi_ = 1.f / patchState_->blockSize;
     }
     ~StereoSuperSaw()
     {
@@ -145,6 +238,10 @@ public:
         {
             SuperSaw::destroy(saws_[i]);
         }
+        StereoDecimator::destroy(decimator_);
+        StereoDecimator::destroy(fadeDecimator_);
+        AudioBuffer::destroy(oversampled_);
+        AudioBuffer::destroy(fade_);
     }
 
     static StereoSuperSaw* create(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
@@ -170,8 +267,40 @@ public:
         float d = Modulate(patchCtrls_->oscDetune, patchCtrls_->oscDetuneModAmount, patchState_->modValue, patchCtrls_->oscDetuneCvAmount, patchCvs_->oscDetune, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
         SetDetune(d);
 
-        saws_[LEFT_CHANNEL]->Process(f, output.getSamples(LEFT_CHANNEL));
-        saws_[RIGHT_CHANNEL]->Process(f, output.getSamples(RIGHT_CHANNEL));
+        int voices = kQualitySuperSawVoices[patchState_->qualityLevel];
+
+        // At high pitches render at a higher rate and decimate.
+        int factor = OscOversamplingFactor(f, oversampling_, kQualityOscOversampling[patchState_->qualityLevel]);
+        if (factor == oversampling_ && voices == voices_)
+        {
+            Render(output, f, oversampling_, voices_, decimator_);
+        }
+        else
+        {
+            // Render the block with both factors and voice counts, from the
+            // same state, and crossfade them.
+            fadeDecimator_->CopyFrom(*decimator_);
+            saws_[LEFT_CHANNEL]->SaveState();
+            saws_[RIGHT_CHANNEL]->SaveState();
+            Render(output, f, oversampling_, voices_, fadeDecimator_);
+
+            saws_[LEFT_CHANNEL]->RestoreState();
+            saws_[RIGHT_CHANNEL]->RestoreState();
+            fade_->clear();
+            Render(*fade_, f, factor, voices, decimator_);
+
+            for (size_t c = 0; c < 2; c++)
+            {
+                float* out = output.getSamples(c).getData();
+                float* in = fade_->getSamples(c).getData();
+                for (size_t i = 0; i < output.getSize(); i++)
+                {
+                    out[i] = LinearCrossFade(out[i], in[i], (i + 1) * xi_);
+                }
+            }
+            oversampling_ = factor;
+            voices_ = voices;
+        }
 
         output.multiply(patchCtrls_->osc2Vol * kOScSuperSawGain);
     }
@@ -2,6 +2,7 @@
 
 #include "Commons.h"
 #include "WaveTableBuffer.h"
+#include "HalfBand.h"
 #include "BiquadFilter.h"
 #include "EnvFollower.h"
 #include <stdlib.h>
@@ -18,6 +19,10 @@ private:
     WaveTableBuffer* wtBuffer_;
     BiquadFilter* filters_[2];
     EnvFollower* ef_[2];
+    StereoDecimator* decimator_;
+    StereoDecimator* fadeDecimator_;
+    AudioBuffer* oversampled_;
+    AudioBuffer* fade_;
 
     HysteresisQuantizer offsetQuantizer_;
 
@@ -28,6 +33,48 @@ private:
     float incR_;
     float xi_;
 
+    int oversampling_;
+
+    /**
+     * @brief Reads the tables for a block at the given factor, the
+     *        frequency and the offset ramp from their previous values.
+     */
+    void ReadTables(AudioBuffer &output, float f, float o, int factor, StereoDecimator* decimator)
+    {
+        size_t size = output.getSize();
+
+        ParameterInterpolator freqParam(&oldFreq_, f, size);
+        ParameterInterpolator offsetParam(&oldOffset_, o, size);
+
+        AudioBuffer* tables = 1 == factor ? &output : oversampled_;
+        float* tableLeft = tables->getSamples(LEFT_CHANNEL).getData();
+        float* tableRight = tables->getSamples(RIGHT_CHANNEL).getData();
+        float inc = incR_ / factor;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            float freq = freqParam.Next() * inc;
+
+            float p = offsetParam.Next();
+            int q = offsetQuantizer_.Process(p);
+            float x = Clamp((p - kWaveTableNofTablesR * q) / kWaveTableNofTablesR);
+
+            for (int j = 0; j < factor; j++)
+            {
+                phase_ += freq;
+                if (phase_ >= kWaveTableLength)
+                {
+                    phase_ -= kWaveTableLength;
+                }
+
+                size_t k = i * factor + j;
+                wtBuffer_->ReadLinear(q, phase_, x, tableLeft[k], tableRight[k]);
+            }
+        }
+
+        decimator->Process(*tables, output, factor);
+    }
+
 public:
     StereoWaveTableOscillator(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState, WaveTableBuffer* wtBuffer)
     {
@@ -44,6 +91,12 @@ public:
         oldOffset_ = 0;
         xi_ = 1.f / patchState_->blockSize;
 
+        decimator_ = StereoDecimator::create(patchState_->blockSize);
+        fadeDecimator_ = StereoDecimator::create(patchState_->blockSize);
+        oversampled_ = AudioBuffer::create(2, patchState_->blockSize * 4);
+        fade_ = AudioBuffer::create(2, patchState_->blockSize);
+        oversampling_ = 1;
+
         for (size_t i = 0; i < 2; i++)
         {
             filters_[i] = BiquadFilter::create(patchState_->sampleRate);
@@ -58,6 +111,10 @@ public:
             BiquadFilter::destroy(filters_[i]);
             EnvFollower::destroy(ef_[i]);
         }
+        StereoDecimator::destroy(decimator_);
+        StereoDecimator::destroy(fadeDecimator_);
+        AudioBuffer::destroy(oversampled_);
+        AudioBuffer::destroy(fade_);
     }
 
     static StereoWaveTableOscillator* create(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState, WaveTableBuffer* wtBuffer)
@@ -86,28 +143,49 @@ public:
         {
             f = oldFreq_;
         }
-        ParameterInterpolator freqParam(&oldFreq_, f, size);
 
         float o = Modulate(patchCtrls_->oscDetune, patchCtrls_->oscDetuneModAmount, patchState_->modValue, patchCtrls_->oscDetuneCvAmount, patchCvs_->oscDetune, 0, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        ParameterInterpolator offsetParam(&oldOffset_, o, size);
 
-        for (size_t i = 0; i < size; i++)
+        // At high pitches the tables are read at a higher rate and decimated,
+        // the rest of the processing stays at the base rate.
+        int factor = OscOversamplingFactor(f, oversampling_, kQualityOscOversampling[patchState_->qualityLevel]);
+        if (factor == oversampling_)
         {
-            phase_ += freqParam.Next() * incR_;
-            if (phase_ >= kWaveTableLength)
+            ReadTables(output, f, o, oversampling_, decimator_);
+        }
+        else
+        {
+            // Read the block at both factors, from the same state, and
+            // crossfade them.
+            float phase = phase_;
+            float oldFreq = oldFreq_;
+            float oldOffset = oldOffset_;
+            HysteresisQuantizer offsetQuantizer = offsetQuantizer_;
+            fadeDecimator_->CopyFrom(*decimator_);
+            ReadTables(output, f, o, oversampling_, fadeDecimator_);
+
+            phase_ = phase;
+            oldFreq_ = oldFreq;
+            oldOffset_ = oldOffset;
+            offsetQuantizer_ = offsetQuantizer;
+            ReadTables(*fade_, f, o, factor, decimator_);
+
+            for (size_t c = 0; c < 2; c++)
             {
-                phase_ -= kWaveTableLength;
+                float* out = output.getSamples(c).getData();
+                float* in = fade_->getSamples(c).getData();
+                for (size_t i = 0; i < size; i++)
+                {
+                    out[i] = LinearCrossFade(out[i], in[i], (i + 1) * xi_);
+                }
             }
+            oversampling_ = factor;
+        }
 
-            float p = offsetParam.Next();
-            int q = offsetQuantizer_.Process(p);
-            float p1 = q * kWaveTableStepLength + phase_;
-            float p2 = p1 + kWaveTableStepLength;
-            float x = Clamp((p - kWaveTableNofTablesR * q) / kWaveTableNofTablesR);
-
-            float left;
-            float right;
-            wtBuffer_->ReadLinear(p1, p2, x, left, right);
+        for (size_t i = 0; i < size; i++)
+        {
+            float left = output.getSamples(LEFT_CHANNEL)[i];
+            float right = output.getSamples(RIGHT_CHANNEL)[i];
 
             left *= Map(ef_[LEFT_CHANNEL]->process(left), 0.f, 0.3f, kOScWaveTablePreGain, 1.f);
             right *= Map(ef_[RIGHT_CHANNEL]->process(right), 0.f, 0.3f, kOScWaveTablePreGain, 1.f);
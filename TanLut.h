@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Commons.h"
+#include <cmath>
+
+/**
+ * @brief Table for tan(pi * f / sr), the prewarped cutoff of the bilinear
+ *        filters. It's indexed by the distance from Nyquist in semitones,
+ *        so it doesn't depend on the sample rate and all the filters of the
+ *        patch can share the same read-only instance.
+ *        It holds the tangent of the half angle, which stays below 1 and
+ *        interpolates well up to Nyquist, where the tangent itself blows up.
+ */
+class TanLut
+{
+private:
+    float lut_[kTanLutSize];
+
+    TanLut()
+    {
+        for (int i = 0; i < kTanLutSize; i++)
+        {
+            // The last entry is 1/16th of a semitone below Nyquist.
+            float semis = (i - kTanLutSize) / float(kTanLutStepsPerSemi);
+            lut_[i] = tanf(kHPi * 0.5f * Power(2.f, semis / kSemi4Oct));
+        }
+    }
+
+public:
+    static const TanLut& Get()
+    {
+        static TanLut instance;
+
+        return instance;
+    }
+
+    /**
+     * @brief Interpolated tan(pi * freq / sampleRate).
+     */
+    inline float Tan(float freq, float sampleRate) const
+    {
+        float x = freq * 2.f / sampleRate;
+        if (x <= 0.f)
+        {
+            return 0.f;
+        }
+
+        float pos = (fast_log2f(x) * kSemi4Oct + kTanLutSemis) * kTanLutStepsPerSemi;
+        if (pos < 0.f)
+        {
+            // Way below the table, tan(x) ~= x.
+            return kHPi * x;
+        }
+
+        float t;
+        if (pos >= kTanLutSize - 1)
+        {
+            t = lut_[kTanLutSize - 1];
+        }
+        else
+        {
+            int i = int(pos);
+            t = lut_[i] + (lut_[i + 1] - lut_[i]) * (pos - i);
+        }
+
+        return 2.f * t / (1.f - t * t);
+    }
+};
@@ -193,6 +193,7 @@ public:
         patchCtrls_->modType = 0.f;
         patchCtrls_->resonatorDissonance = 0.f;
         patchCtrls_->echoFilter = 0.55f; // Center is not 0.5
+        patchCtrls_->echoVoicing = 0.f; // Classic
         patchCtrls_->ambienceAutoPan = 0.f;
 
         // Modulation
@@ -288,7 +289,7 @@ public:
             &patchCtrls_->ambienceSpacetimeModAmount,
             &patchCtrls_->ambienceSpacetimeCvAmount, 0.005f);
         knobs_[PARAM_KNOB_AMBIENCE_DECAY] = KnobController::create(patchState_,
-            &patchCtrls_->ambienceDecay, NULL, &patchCtrls_->ambienceDecayModAmount,
+            &patchCtrls_->ambienceDecay, &patchCtrls_->echoVoicing, &patchCtrls_->ambienceDecayModAmount,
             &patchCtrls_->ambienceDecayCvAmount);
 
         knobs_[PARAM_KNOB_MOD_LEVEL] =
@@ -806,6 +807,16 @@ public:
 
     // Callback.
     void ProcessMidi(MidiMessage msg) {
+        // Held notes tune the resonator bank.
+        if (msg.isNoteOff()) {
+            patchState_->heldNotes.NoteOff(msg.getNote());
+            return;
+        }
+        if (msg.isNoteOn()) {
+            patchState_->heldNotes.NoteOn(msg.getNote());
+            return;
+        }
+
         return;
 
         if (msg.isControlChange()) {
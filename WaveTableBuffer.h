@@ -3,19 +3,43 @@
 #include "Commons.h"
 #include "Interpolator.h"
 
+/**
+ * @brief Snapshot of the looper's buffer arranged for the wavetable
+ *        oscillator. Each of the tables is stored contiguously with the two
+ *        channels interleaved and followed by a guard sample, so that a read
+ *        never has to wrap around. The snapshot is refreshed only where the
+ *        looper writes into the scanned regions.
+ */
 class WaveTableBuffer
 {
 private:
     FloatArray* buffer_;
-    int writeHead_;
+    FloatArray snapshot_;
+
+    inline void RefreshFrame(int frame, int start, int end)
+    {
+        const float* left = buffer_->getData() + frame * kWaveTableStepLength;
+        const float* right = left + kLooperChannelBufferLength;
+        float* dst = snapshot_.getData() + (frame * kWaveTableFrameLength) * 2;
+
+        for (int i = start; i < end; i++)
+        {
+            dst[i * 2] = left[i];
+            dst[i * 2 + 1] = right[i];
+        }
+    }
 
 public:
     WaveTableBuffer(FloatArray* buffer)
     {
         buffer_ = buffer;
-        writeHead_ = 0;
+        snapshot_ = FloatArray::create(kWaveTableSnapshotLength);
+        Refresh(0, kLooperChannelBufferLength);
+    }
+    ~WaveTableBuffer()
+    {
+        FloatArray::destroy(snapshot_);
     }
-    ~WaveTableBuffer() {}
 
     static WaveTableBuffer* create(FloatArray* buffer)
     {
@@ -27,49 +51,75 @@ public:
         delete obj;
     }
 
-    inline float ReadLeft(uint32_t position)
+    /**
+     * @brief Copies the samples that have been written to the looper's buffer
+     *        into the snapshot, if they belong to a table.
+     *
+     * @param position Position of the first written sample (per channel)
+     * @param length Number of written samples
+     */
+    void Refresh(uint32_t position, uint32_t length)
     {
         while (position >= kLooperChannelBufferLength)
         {
             position -= kLooperChannelBufferLength;
         }
-        while (position < 0)
+        if (length > kLooperChannelBufferLength)
         {
-            position += kLooperChannelBufferLength;
+            length = kLooperChannelBufferLength;
         }
 
-        return buffer_->getElement(position);
-    }
+        while (length > 0)
+        {
+            int frame = position / kWaveTableStepLength;
+            uint32_t offset = position - frame * kWaveTableStepLength;
+            uint32_t count = kWaveTableStepLength - offset;
+            if (count > length)
+            {
+                count = length;
+            }
 
-    inline float ReadRight(uint32_t position)
-    {
-        position += kLooperChannelBufferLength;
+            if (offset < kWaveTableFrameLength)
+            {
+                uint32_t end = offset + count;
+                RefreshFrame(frame, offset, end < kWaveTableFrameLength ? end : kWaveTableFrameLength);
+            }
 
-        while (position >= kLooperTotalBufferLength)
-        {
-            position -= kLooperChannelBufferLength;
-        }
-        while (position < kLooperChannelBufferLength)
-        {
-            position += kLooperChannelBufferLength;
+            position += count;
+            if (position >= kLooperChannelBufferLength)
+            {
+                position = 0;
+            }
+            length -= count;
         }
-
-        return buffer_->getElement(position);
     }
 
-    inline void ReadLinear(float p1, float p2, float x, float &left, float &right)
+    /**
+     * @brief Reads both channels from two adjacent tables, each one with
+     *        linear interpolation, and crossfades between them.
+     *
+     * @param table Index of the first table, the second one is the next
+     *        (wrapping around)
+     * @param phase Position in the tables, must be in [0, kWaveTableLength)
+     * @param x Crossfade between the two tables
+     */
+    inline void ReadLinear(int table, float phase, float x, float &left, float &right)
     {
-        float l0, l1;
-        float r0, r1;
+        uint32_t i = uint32_t(phase);
+        float f = phase - i;
+
+        int next = table + 1;
+        if (next == kWaveTableNofTables)
+        {
+            next = 0;
+        }
 
-        uint32_t i1 = uint32_t(p1);
-        uint32_t i2 = uint32_t(p2);
-        float f1 = p1 - i1;
-        float f2 = p2 - i2;
+        const float* f1 = snapshot_.getData() + (table * kWaveTableFrameLength + i) * 2;
+        const float* f2 = snapshot_.getData() + (next * kWaveTableFrameLength + i) * 2;
 
         float x0 = 1.f - x;
 
-        left = Interpolator::linear(ReadLeft(i1), ReadLeft(i1 + 1), f1) * x0 + Interpolator::linear(ReadLeft(i2), ReadLeft(i2 + 1), f2) * x;
-        right = Interpolator::linear(ReadRight(i1), ReadRight(i1 + 1), f1) * x0 + Interpolator::linear(ReadRight(i2), ReadRight(i2 + 1), f2) * x;
+        left = Interpolator::linear(f1[0], f1[2], f) * x0 + Interpolator::linear(f2[0], f2[2], f) * x;
+        right = Interpolator::linear(f1[1], f1[3], f) * x0 + Interpolator::linear(f2[1], f2[3], f) * x;
     }
 };